@@ -54,13 +54,27 @@
 #endif
 
 #ifdef __linux__
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <cstring>
+#include <ctime>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#define __cdecl
+#ifdef CORO_IO_URING
+#include <linux/io_uring.h>
+#endif
 #endif
 
 #include <openssl/rand.h>
@@ -76,25 +90,55 @@
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
+#include <csignal>
 #include <cstdlib>
 #include <string>
 #include <algorithm>
 #include <queue>
 #include <vector>
 #include <mutex>
+#include <atomic>
 
 #ifndef CORO_STACK_SIZE
 #define CORO_STACK_SIZE 1048576
 //#define CORO_STACK_SIZE 102400
 #endif
 
+#ifndef CORO_STACK_GUARD_SIZE
+#define CORO_STACK_GUARD_SIZE 65536 // No-access bytes below each stack
+#endif
+
+#ifndef CORO_STACK_POOL_SIZE
+#define CORO_STACK_POOL_SIZE (4*CORO_STACK_SIZE) // Default bytes of free stacks per hub
+#endif
+
+#ifndef CORO_PREEMPT_SIGNAL
+#define CORO_PREEMPT_SIGNAL SIGURG // Preemption timer signal (Linux only)
+#endif
+
+#ifndef CORO_WATCHDOG_SIGNAL
+#define CORO_WATCHDOG_SIGNAL (SIGRTMIN+1) // Stall backtraces (Linux only)
+#endif
+
+#ifndef CORO_POLL_BATCH
+#define CORO_POLL_BATCH 128 // Default max # of I/O events handled per poll
+#endif
+
+#ifndef CORO_RING_SIZE
+#define CORO_RING_SIZE 1024 // Number of io_uring SQEs (CORO_IO_URING only)
+#endif
+
 namespace coro {
 class Coroutine;
 class Channel;
 class Event;
 class Hub;
+class RunQueue;
 class Selector;
+class SharedStack;
+class StackPool;
 class Socket;
+class Watchdog;
 
 template <typename T>
 using Ptr = std::shared_ptr<T>;
@@ -24,10 +24,13 @@
 
 #include "coro/Common.hpp"
 #include "coro/Time.hpp"
+#include "coro/Timer.hpp"
 
 extern "C" {
 void __cdecl coroSwapContext(coro::Coroutine* from, coro::Coroutine* to);
 void __cdecl coroStart() throw();
+extern thread_local coro::Coroutine* coroCurrent; // Running coroutine
+extern thread_local volatile sig_atomic_t coroPreemptTicks; // See checkpoint()
 }
 
 namespace coro {
@@ -36,6 +39,11 @@ Ptr<Coroutine> current();
 Ptr<Coroutine> main();
 void yield();
 void sleep(Time const& time);
+void preempt(); // Slow path of checkpoint()
+bool onSharedStack(void const* addr); // True if 'addr' is on a shared stack
+#ifdef __linux__
+void registerPreemptHandler(); // Called by Hub::preemptIs()
+#endif
 #ifdef _WIN32
 LONG WINAPI fault(LPEXCEPTION_POINTERS info);
 #else
@@ -44,21 +52,86 @@ void fault(int signo, siginfo_t* info, void* context);
 
 
 class Stack {
-// Lazily-allocated stack for a coroutine.  When a new coroutine stack is
-// created, a block of virtual memory is reserved for the coroutine with memory
-// protection enabled.  When the process first accesses a previously
-// unallocated for the coroutine, the page is allocated and the permissions set
-// to allow reads/writes.  In this way, the coroutine only uses the stack
-// memory it needs.  A coroutine's stack never shrinks; to garbage-collect the
-// stack, the coroutine must be destroyed.
+// Stack for a coroutine, taken from (and returned to) the thread's StackPool.
+// Stacks are mapped directly from the OS, with a no-access guard region below
+// them that turns an overflow into a fault.  The pages of a new stack are only
+// faulted in as the coroutine touches them, so the coroutine only uses the
+// stack memory it needs (on Windows, the whole stack is still committed; see
+// stackAlloc()).  A stack doesn't shrink by itself when the coroutine
+// returns from a deep call; the hub trims the stacks of long-idle coroutines
+// instead (see Hub::stackTrimIs()).  An unpooled stack is mapped at its exact
+// (page-rounded) size and unmapped when it's destroyed.
 public:
-    Stack(uint32_t size);
+    enum { MIN_SIZE = 16384 }; // Smallest coroutine stack (one pool class)
+    Stack(uint32_t size, bool pooled=true);
     ~Stack(); 
     uint8_t* end() { return data_+size_; }
     uint8_t* begin() { return data_; }
+    uint64_t trim(uint8_t const* sp); // Returns resident bytes released
 private:
     uint8_t* data_;
     uint64_t size_;
+    bool pooled_;
+    friend class Coroutine;
+};
+
+class StackPool {
+// Recycles the stacks of destroyed coroutines.  Stacks are grouped in
+// power-of-two size classes (16 KiB up to 16 MiB); a new stack is rounded up
+// to its class and taken from the class's free list if possible, so spawning
+// a coroutine doesn't have to allocate (and fault in) a fresh stack.  Free
+// stacks are linked through their own memory.  Each hub owns a pool, which
+// serves the stacks of coroutines created on the hub's thread; stacks outside
+// the size classes, or beyond the pool's capacity, are freed right away.  The
+// pages a pooled stack's last coroutine touched stay resident, so the default
+// capacity is only a few stacks (CORO_STACK_POOL_SIZE); hubs that spawn in
+// bigger bursts can raise it with capacityIs().
+public:
+    StackPool();
+    ~StackPool();
+    uint8_t* alloc(uint64_t& size); // Rounds 'size' up to its size class
+    void free(uint8_t* data, uint64_t size);
+    void capacityIs(uint64_t bytes); // Max bytes of free stacks kept
+    uint64_t capacity() const { return capacity_; }
+    uint64_t bytes() const { return bytes_; } // Bytes of free stacks kept
+    uint64_t hits() const { return hits_; } // Allocations served from the pool
+    uint64_t misses() const { return misses_; }
+    static StackPool* local(); // The calling thread's pool, if any
+
+private:
+    StackPool(StackPool const&);
+    StackPool& operator=(StackPool const&);
+    enum { CLASSES = 11, MIN_SHIFT = 14 };
+    struct FreeStack { FreeStack* next; };
+    static int sizeClass(uint64_t size);
+    FreeStack* free_[CLASSES];
+    uint64_t capacity_;
+    uint64_t bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+};
+
+class SharedStack {
+// Execution stack shared by the coroutines of a hub that run in shared-stack
+// mode (see Hub::startShared()).  Only one of them, the owner, has its frames
+// on the stack at a time.  Before another one runs, the owner's live frames
+// (from its saved stack pointer to the top of the stack) are copied out to a
+// heap buffer of exactly that size, and the new coroutine's frames are copied
+// back in at the same addresses.  An idle coroutine therefore costs only as
+// much memory as its suspended frames use, typically a few hundred bytes.
+//
+// The catch is that a suspended coroutine's locals aren't where they were:
+// nothing else may hold a pointer or reference into its stack while it's
+// asleep.  Sockets, in particular, must be allocated on the heap.  The copies
+// also make each switch cost O(frame size), so shared-stack mode suits large
+// numbers of mostly-idle coroutines with shallow stacks.
+public:
+    SharedStack(uint32_t size) : stack_(size), owner_(0) {}
+    void ownerIs(Coroutine* coro); // Moves 'coro's frames onto the stack
+    bool contains(void const* addr);
+private:
+    Stack stack_;
+    Coroutine* owner_; // Coroutine whose frames are on the stack, if any
     friend class Coroutine;
 };
 
@@ -86,17 +159,41 @@ public:
         EXITED, // Coroutine has exited cleanly
     };
 
+    enum Priority {
+        CRITICAL, // Latency-critical; served first on every quiesce() pass
+        NORMAL, // Default class for new coroutines
+        BACKGROUND, // Batch work; gives way to the other classes
+        PRIORITIES // Number of priority classes
+    };
+
     ~Coroutine();
 
     template <typename F>
-    Coroutine(F func) : stack_(CORO_STACK_SIZE) { init(func); }
+    Coroutine(F func) : stack_(CORO_STACK_SIZE), timer_([this] { notify(); }) {
+        init(func);
+    }
+    template <typename F>
+    Coroutine(F func, uint32_t stackSize, bool pooled=true) :
+        stack_(std::max(stackSize, uint32_t(Stack::MIN_SIZE)), pooled),
+        timer_([this] { notify(); }) {
+        init(func);
+    }
+    template <typename F>
+    Coroutine(F func, Ptr<SharedStack> const& shared) :
+        stack_(0), timer_([this] { notify(); }), shared_(shared) {
+        init(func);
+    }
     Status status() const { return status_; }
+    Priority priority() const { return priority_; }
+    void priorityIs(Priority priority);
+    Time const& runTime() const { return runTime_; } // Total time run
+    Time const& burstTime() const { return burstTime_; } // Run since last wait
+    size_t stackSaved() const { return savedSize_; } // Shared-stack bytes saved
     void join();
 
 private:
     Coroutine(); // Special constructor for the main thread.
     void init(std::function<void()> const& func);
-    void commit(uint64_t addr);
     void exit();
     void start() throw();
     void swap(); // Passes control to this coroutine
@@ -105,18 +202,32 @@ private:
     void unblock();
     void wait(); // Enter WAITING state
     void notify(); // Exit WAITING state
-    bool isMain() { return !stack_.begin(); }
+    bool isMain() { return !stack_.begin() && !shared_; }
+    static void destroy(Coroutine* coro); // Deleter for Hub::start()'s Ptrs
+    Stack& stack() { return shared_ ? shared_->stack_ : stack_; }
 
     uint8_t* stackPointer_; // This field must be the first field in the coroutine
-    std::function<void()> func_; 
     Status status_;
+    Priority priority_; // Selects the hub run queue; see Hub::quiesce()
+    Coroutine* next_; // Run queue links; kept in the same cache line as
+    Coroutine* prev_; // stackPointer_ and status_, which the hub also touches
+    RunQueue* queue_; // Run queue this coroutine is on, if any
+    std::function<void()> func_; 
     Stack stack_;
     Ptr<Event> event_;
+    Timer timer_; // Wakes the coroutine from sleep()
+    Time runTime_; // Accounted only while the hub has a time budget
+    Time burstTime_; // Run time since it last blocked or waited
+    Time idled_; // When it last blocked or waited, if its stack may be trimmed
+    Ptr<SharedStack> shared_; // Stack to run on, if in shared-stack mode
+    uint8_t* saved_; // Frames saved off the shared stack
+    size_t savedSize_;
 
     friend Ptr<Coroutine> coro::current();
     friend Ptr<Coroutine> coro::main();
     friend void coro::yield();
     friend void coro::sleep(Time const& time);
+    friend void coro::preempt();
     friend void ::coroStart() throw();
 #ifdef _WIN32
     friend LONG WINAPI coro::fault(LPEXCEPTION_POINTERS info);
@@ -124,9 +235,101 @@ private:
     friend void coro::fault(int signo, siginfo_t* info, void* context);
 #endif
     friend class coro::Hub;
+    friend class coro::RunQueue;
+    friend class coro::SharedStack;
+    friend bool coro::onSharedStack(void const* addr);
     friend class coro::Socket;
     friend class coro::Event;
     friend class coro::Selector;
 };
 
+inline void checkpoint() {
+// Preemption safe point.  Yields to the hub if the calling coroutine has run
+// for at least a full preemption slice since it was last switched in (see
+// Hub::preemptIs()); otherwise it's a single thread-local load.  Call it from
+// long-running loops that might otherwise starve the hub.
+    if (coroPreemptTicks > 1) {
+        preempt();
+    }
+}
+
+struct StartOptions {
+// Options for a new coroutine (see Hub::start()).  The defaults give the same
+// coroutine as start() without options.  Lightweight tasks (timers, small
+// handlers) can get by with a 16-64 KiB stack, so many more of them fit in
+// memory; there's no way to grow a stack later, and overflowing it aborts.
+    StartOptions() :
+        stackSize(CORO_STACK_SIZE),
+        pooled(true),
+        shared(false),
+        priority(Coroutine::NORMAL) {}
+    uint32_t stackSize; // Bytes; at least Stack::MIN_SIZE, rounded up
+    bool pooled; // Take the stack from the hub's StackPool (power-of-two classes)
+    bool shared; // Run on the hub's shared stack; ignores stackSize and pooled
+    Coroutine::Priority priority;
+};
+
+class RunQueue {
+// FIFO queue of runnable coroutines.  The links are stored in the coroutines
+// themselves, so scheduling a coroutine never allocates or touches a reference
+// count.  A coroutine is on at most one queue; if it's destroyed while queued,
+// it removes itself.
+public:
+    RunQueue() : head_(0), tail_(0), size_(0) {}
+    ~RunQueue();
+    void push(Coroutine* coro);
+    Coroutine* pop(); // Returns null if the queue is empty
+    Coroutine* front() const { return head_; }
+    void del(Coroutine* coro);
+    bool empty() const { return !head_; }
+    size_t size() const { return size_; }
+
+private:
+    RunQueue(RunQueue const&);
+    RunQueue& operator=(RunQueue const&);
+    Coroutine* head_;
+    Coroutine* tail_;
+    size_t size_;
+};
+
+inline void RunQueue::push(Coroutine* coro) {
+    assert(!coro->queue_ && "coroutine is already queued");
+    coro->queue_ = this;
+    coro->next_ = 0;
+    coro->prev_ = tail_;
+    if (tail_) {
+        tail_->next_ = coro;
+    } else {
+        head_ = coro;
+    }
+    tail_ = coro;
+    size_++;
+}
+
+inline Coroutine* RunQueue::pop() {
+    Coroutine* coro = head_;
+    if (coro) {
+        del(coro);
+    }
+    return coro;
+}
+
+inline void RunQueue::del(Coroutine* coro) {
+    assert(coro->queue_ == this);
+    if (coro->prev_) {
+        coro->prev_->next_ = coro->next_;
+    } else {
+        head_ = coro->next_;
+    }
+    if (coro->next_) {
+        coro->next_->prev_ = coro->prev_;
+    } else {
+        tail_ = coro->prev_;
+    }
+    coro->next_ = 0;
+    coro->prev_ = 0;
+    coro->queue_ = 0;
+    size_--;
+}
+
 }
@@ -23,17 +23,21 @@
 #pragma once
 
 #include "coro/Common.hpp"
+#include "coro/Hub.hpp"
+#include "coro/Time.hpp"
 
 namespace coro {
 
 class EventRecord {
+// Refers to a waiting coroutine without owning it, so that a coroutine that
+// loses its last owner while waiting is unwound when it wakes up.
 public:
     EventRecord(Ptr<Coroutine> coro);
     EventRecord();
-    Ptr<Coroutine> coroutine() const { return coroutine_; }
+    Ptr<Coroutine> coroutine() const { return coroutine_.lock(); }
 
 private:
-    Ptr<Coroutine> coroutine_;
+    WeakPtr<Coroutine> coroutine_;
 };
 
 typedef size_t EventWaitToken;
@@ -43,11 +47,15 @@ class Event {
 // on an event is put to sleep until another coroutine wakes it via the notify
 // method.  By calling wait() inside a conditional loop, a coroutine can
 // efficiently wait for a condition to become true -- thus enabling it to be
-// used for triggers, etc.
+// used for triggers, etc.  The timed waits cancel their timer as soon as the
+// wait ends, so they also work as an interruptible sleep: notifyAll() cuts
+// the wait short.
 public:
     virtual ~Event() {}
     void notifyAll(); // Notify all coroutines (add them to the runnable list)
     void wait(); // Add a coroutine to the wait set
+    bool waitFor(Time const& timeout); // False if 'timeout' elapsed first
+    bool waitUntil(Time const& time); // False if 'time' passed first
     
     template <typename F> 
     void wait(F cond) {
@@ -56,6 +64,23 @@ public:
         }
     }
 
+    template <typename F>
+    bool waitUntil(Time const& time, F cond) {
+    // Waits until 'cond' is true, or until 'time' passes.  Returns the final
+    // value of 'cond'.
+        while (!cond()) {
+            if (!waitUntil(time)) {
+                return cond();
+            }
+        }
+        return true;
+    }
+
+    template <typename F>
+    bool waitFor(Time const& timeout, F cond) {
+        return waitUntil(Time::now()+timeout, cond);
+    }
+
 private:
     size_t waiters() const { return waiter_.size(); }
     EventWaitToken waitToken(Ptr<Coroutine> waiter);
@@ -24,27 +24,14 @@
 
 #include "coro/Common.hpp"
 #include "coro/Coroutine.hpp"
+#include "coro/Timer.hpp"
+#include "coro/Watchdog.hpp"
 
 namespace coro {
 
-Ptr<Hub> hub();
+Ptr<Hub> hub(); // Returns the calling thread's hub
 void run();
 
-class Timeout {
-// Record to track when a coroutine should be scheduled in the future.  When
-// the time elapses, the coroutine is resumed.
-public:
-    Timeout(Time const& time, Ptr<Coroutine> coro) : time_(time), coroutine_(coro) {}
-    bool operator<(Timeout const& rhs) const { return time_ > rhs.time_; }
-    bool operator==(Timeout const& rhs) const { return time_ == rhs.time_; }
-
-    Time const& time() const { return time_; }
-    Ptr<Coroutine> coroutine() const { return coroutine_; }
-private:
-    Time time_;
-    Ptr<Coroutine> coroutine_;
-};
-
 #ifdef _WIN32
 struct Overlapped {
     OVERLAPPED overlapped;
@@ -54,31 +41,163 @@ struct Overlapped {
 };
 #endif
 
+#ifdef CORO_IO_URING
+struct Completion {
+// Record for an io_uring operation.  Its address is the user_data of the SQE;
+// when the CQE arrives, the hub stores the result and unblocks the coroutine
+// (like Overlapped for I/O completion ports).
+    Coroutine* coroutine;
+    int result;
+};
+
+class IoRing {
+// Submission and completion queues shared with the kernel.  SQEs are only
+// queued by sqe(); they are submitted in bulk by the next enter() call, so a
+// single io_uring_enter() submits everything queued during a quiesce pass and
+// reaps the completions that are ready.
+public:
+    IoRing(unsigned entries=CORO_RING_SIZE);
+    ~IoRing();
+    struct io_uring_sqe* sqe(); // Returns a zeroed SQE, or null if full
+    void enter(unsigned wait, Time const* timeout); // Submit & wait for CQEs
+    struct io_uring_cqe* cqe(); // Returns the next CQE, or null if none
+    void cqeDel(); // Marks the CQE returned by cqe() as consumed
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+    unsigned pending_; // SQEs queued, but not yet submitted
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned sqEntries_;
+    unsigned sqeTail_; // Local tail; published to sqTail_ by enter()
+    struct io_uring_sqe* sqes_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    struct io_uring_cqe* cqes_;
+    void* ring_; // SQ and CQ rings
+    size_t ringSize_;
+    size_t sqesSize_;
+};
+#endif
+
+class Post {
+// A closure queued by Hub::post().  Posts form an intrusive singly-linked list,
+// so queuing one is a single compare-and-swap.
+public:
+    Post(std::function<void()> const& func) : func_(func), next_(0) {}
+private:
+    std::function<void()> func_;
+    Post* next_;
+    friend class Hub;
+};
+
+#if defined(_WIN32)
+typedef OVERLAPPED_ENTRY PollEvent;
+#elif defined(__APPLE__)
+typedef struct kevent PollEvent;
+#elif !defined(CORO_IO_URING)
+typedef struct epoll_event PollEvent;
+#endif
+
 class Hub {
 // The hub manages all coroutines, events, and I/O.  It runs an event loop that
 // schedules coroutines to run when the events they are waiting on (channel,
-// I/O, etc.) have signaled.
+// I/O, etc.) have signaled.  There is one hub per thread; coroutines,
+// sockets and events belong to the hub of the thread that created them.
 public:
     template <typename F>
-    Ptr<Coroutine> start(F func) { 
-        Ptr<Coroutine> coro(new Coroutine(func));
-        runnable_.push_back(coro);
+    Ptr<Coroutine> start(F func, StartOptions const& options=StartOptions()) {
+        Ptr<Coroutine> coro;
+#if !defined(_WIN32) && !defined(CORO_IO_URING)
+        // Shared stacks don't work where the kernel writes to buffers on the
+        // stack while the coroutine is suspended; those get a regular stack.
+        if (options.shared) {
+            coro.reset(new Coroutine(func, sharedStack()), Coroutine::destroy);
+        }
+#endif
+        if (!coro) {
+            coro.reset(new Coroutine(func, options.stackSize, options.pooled),
+                Coroutine::destroy);
+        }
+        coro->priority_ = options.priority;
+        schedule(coro.get());
         return coro;
     }
+    template <typename F>
+    Ptr<Coroutine> startShared(F func) {
+        StartOptions options;
+        options.shared = true;
+        return start(func, options);
+    }
+    void post(std::function<void()> const& func); // Thread-safe
+    void timerIs(Timer* timer, Time const& time); // Runs 'timer' at 'time'
+    void timerDel(Timer* timer); // Cancels 'timer'
     void quiesce();
-    void poll();
+    size_t poll(); // Returns the number of I/O events handled
     void run();
+    size_t runnable() const; // # of coroutines ready to run
+    size_t weight(Coroutine::Priority priority) const;
+    void weightIs(Coroutine::Priority priority, size_t weight);
+    void quiesceBudgetIs(size_t coroutines, Time const& time);
+    StackPool& stackPool() { return stackPool_; }
+    Ptr<SharedStack> sharedStack(); // Stack for startShared() coroutines
+    size_t handoffMax() const { return handoffMax_; }
+    void handoffMaxIs(size_t handoffs);
+    Time const& preempt() const { return preempt_; }
+    void preemptIs(Time const& slice); // Zero turns preemption off
+    Time const& stackTrim() const { return stackTrim_; }
+    void stackTrimIs(Time const& idle); // Zero turns stack trimming off
+    uint64_t stackTrimmed() const { return stackTrimmed_; } // Bytes released
+    void watchdogIs(Time const& threshold, StallHandler const& handler=stallPrint);
+    // Cached Time::now(), which is only refreshed around polls, so it can lag
+    // behind while coroutines run.  Relative timeouts (sleep(), waitFor(),
+    // Socket timeouts) are measured from Time::now() instead.
+    Time const& now() const { return now_; }
 #ifdef _WIN32
     HANDLE handle() const { return handle_; }
 #else
     int handle() const { return handle_; }
 #endif
-    std::mutex const& mutex() const { return mutex_; }
+#ifdef CORO_IO_URING
+    struct io_uring_sqe* sqe(); // Returns a zeroed SQE; see Hub.uring.inl
+#endif
+    size_t pollBatch() const { return pollBatch_; }
+    void pollBatchIs(size_t batch); // Max # of I/O events handled per poll()
+    uint64_t pollsSkipped() const { return pollsSkipped_; }
+    void pollSkipMaxIs(size_t iterations, Time const& latency);
+    Time const& busyPoll() const { return busyPoll_; }
+    int socketBusyPoll() const { return socketBusyPoll_; }
+    uint64_t busyPollHits() const { return busyPollHits_; } // I/O found spinning
+    void busyPollIs(Time const& window, int socketBusyPoll=0);
+
+    ~Hub();
 
 private:
     Hub();
-    std::vector<WeakPtr<Coroutine>> runnable_;
-    std::priority_queue<Timeout, std::vector<Timeout>> timeout_;
+    StackPool stackPool_; // First, so that it's destroyed last
+    Ptr<SharedStack> sharedStack_; // Created by the first startShared()
+    RunQueue runnable_[Coroutine::PRIORITIES]; // One per priority class
+    size_t weight_[Coroutine::PRIORITIES]; // Round-robin quantum per class
+    size_t quiesceBudget_; // Max # of coroutines run per quiesce() pass
+    Time quiesceBudgetTime_; // Max time per quiesce() pass
+    Time switched_; // Time of the last switch (only kept with a time budget)
+    RunQueue handoff_; // Coroutine woken by the running one; see wake()
+    size_t handoffs_; // # of handoffs since quiesce() last dequeued
+    size_t handoffMax_;
+    RunQueue idle_; // Waiting/blocked coroutines to trim, longest-idle first
+    RunQueue reap_; // Unowned coroutines to destroy; see Coroutine::destroy()
+    Time stackTrim_; // Idle time after which a coroutine's stack is trimmed
+    uint64_t stackTrimmed_; // Total resident stack bytes released
+    Time preempt_; // Preemption slice (CPU time)
+#ifdef __linux__
+    timer_t preemptTimer_; // Ticks coroPreemptTicks every preempt_
+    bool preemptTimerValid_;
+#endif
+    TimerWheel timer_;
+    Timer trimTimer_; // Runs trim() when the longest-idle coroutine is due
     int blocked_;
     int waiting_;
 #ifdef _WIN32
@@ -86,20 +205,74 @@ private:
 #else
     int handle_; 
 #endif
-    std::mutex mutex_;
+#ifdef CORO_IO_URING
+    IoRing ring_;
+#else
+    std::vector<PollEvent> event_; // Buffer for harvesting I/O events
+#endif
+    size_t pollBatch_;
+    size_t pollSkip_; // # of polls to skip while there's runnable work
+    size_t pollSkipped_; // # of consecutive polls skipped so far
+    size_t pollSkipMax_; // Cap on pollSkip_
+    Time pollLatencyMax_; // Max time between polls while skipping
+    Time polled_; // Time of the last poll
+    uint64_t pollsSkipped_; // Total # of polls skipped
+    Time busyPoll_; // Time to spin before blocking in poll()
+    int socketBusyPoll_; // SO_BUSY_POLL value for new sockets (us)
+    uint64_t busyPollHits_; // Total # of polls that found I/O while spinning
+    std::atomic<Post*> posted_; // Closures posted by post(), newest first
+    std::atomic<bool> signaled_; // Set if a wakeup is pending
+#if !defined(_WIN32) && !defined(__APPLE__)
+    int wakeup_; // eventfd used to wake up the hub
+#endif
+#if defined(__linux__) && !defined(CORO_IO_URING)
+    int timerfd_; // Wakes epoll_wait() at sub-millisecond deadlines
+    Time timerfdExpiry_; // Absolute time timerfd_ is armed for
+#endif
+#ifdef CORO_IO_URING
+    Completion wakeupOp_; // Pending read on wakeup_
+    uint64_t wakeupCount_;
+    bool wakeupArmed_; // False if re-arming wakeupOp_ has to wait for room
+#endif
     Time now_;
+    std::atomic<uint64_t> beat_; // Bumped every iteration & switch; see Watchdog
+    std::atomic<Coroutine*> active_; // Coroutine quiesce() is running, if any
+    std::atomic<bool> polling_; // Set while run() is in poll()
+    std::atomic<bool> running_; // Set while the thread is in run()
+    Ptr<Watchdog> watchdog_;
 
-    void timeoutIs(Timeout const& timeout);
+    void schedule(Coroutine* coro) { runnable_[coro->priority_].push(coro); }
+    void wake(Coroutine* coro); // Schedules a coroutine woken by an event
+    Coroutine* handoff(Coroutine* from); // Picks the next coroutine to run
+    void resume(Coroutine* coro); // Runs a coroutine from quiesce()
+    void account(Coroutine* coro); // Charges run time to a coroutine
+    void idle(Coroutine* coro); // Queues a coroutine's stack for trimming
+    void trim(); // Trims the stacks of long-idle coroutines
+    void reap(); // Destroys coroutines handed over by Coroutine::destroy()
+    size_t harvest(Time const* timeout); // Platform-specific I/O wait
+#ifdef CORO_IO_URING
+    size_t complete(size_t max); // Handles up to 'max' ready CQEs
+#endif
+    void pollInit(); // Platform-specific wakeup and timer setup
+    void signal(); // Platform-specific wakeup; interrupts harvest()
+    void dispatch(); // Runs posted closures
+    void beat(); // Marks progress for the watchdog
 
     friend Ptr<Hub> coro::hub();
     friend void coro::sleep(Time const& time);
     friend class Coroutine;
     friend class Event;
+    friend class Watchdog;
 };
 
 template <typename F>
-Ptr<Coroutine> start(F func) {
-    return hub()->start(func);
+Ptr<Coroutine> start(F func, StartOptions const& options=StartOptions()) {
+    return hub()->start(func, options);
+}
+
+template <typename F>
+Ptr<Coroutine> startShared(F func) {
+    return hub()->startShared(func);
 }
 
 template <typename F>
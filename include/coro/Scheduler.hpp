@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "coro/Common.hpp"
+#include "coro/Event.hpp"
+#include "coro/Time.hpp"
+#include <atomic>
+#include <deque>
+#include <thread>
+
+namespace coro {
+
+typedef std::function<void()> Task;
+
+class Scheduler {
+// Runs coroutines on a pool of worker threads, each with its own hub.  Every
+// worker owns a deque of tasks that haven't started yet: start() pushes onto
+// the calling worker's deque (or onto the workers' deques in turn when called
+// from outside the pool), a worker pops its own tasks from the back, and an
+// idle worker steals from the front of another worker's deque.  Once a task
+// starts running as a coroutine, it stays on that worker's hub, since its
+// stack, sockets and events belong to that thread.  Objects that a task
+// touches should therefore be created inside the task.  Workers with nothing
+// to do sleep in their hub's poll(), and are woken through Hub::post() when
+// a task arrives.
+public:
+    Scheduler(size_t workers=std::thread::hardware_concurrency());
+    ~Scheduler(); // Calls join()
+    void start(Task const& task); // Queue a task to run as a coroutine
+    void join(); // Wait for all tasks to exit, then stop the workers
+    size_t workers() const { return worker_.size(); }
+    uint64_t steals() const { return steals_; }
+
+private:
+    struct Worker {
+        Worker() : idle(false) {}
+        std::mutex mutex;
+        std::deque<Task> task;
+        std::thread thread;
+        Ptr<Hub> hub; // Set by the worker before it first goes idle
+        Event event; // Notified (via hub->post()) to wake the dispatcher
+        std::atomic<bool> idle; // Set while the dispatcher waits on 'event'
+    };
+
+    void dispatch(size_t id);
+    bool pop(size_t id, Task& task);
+    bool steal(size_t id, Task& task);
+    void wake(size_t id);
+
+    std::vector<Ptr<Worker>> worker_;
+    std::atomic<size_t> queued_; // Tasks queued, but not yet started
+    std::atomic<size_t> next_; // Next worker for tasks from outside the pool
+    std::atomic<uint64_t> steals_;
+    std::atomic<bool> joining_;
+};
+
+}
@@ -23,6 +23,8 @@
 #pragma once
 
 #include "coro/Common.hpp"
+#include "coro/Time.hpp"
+#include "coro/Timer.hpp"
 
 namespace coro {
 
@@ -46,6 +48,20 @@ public:
     SocketCloseException() {}
 };
 
+class SocketTimeoutException {
+// Thrown when a blocking socket operation runs past the socket's timeout or
+// deadline.  The socket is still open; the operation simply didn't happen.
+public:
+    SocketTimeoutException() {}
+};
+
+#ifdef _WIN32
+struct Overlapped;
+#endif
+#ifdef CORO_IO_URING
+struct Completion;
+#endif
+
 #ifdef _WIN32
 typedef SOCKET SocketHandle;
 #else
@@ -72,13 +88,69 @@ public:
     void readAll(char* buf, size_t len, int flags=0); // Write whole buffer
     int fileno() const;
     void setsockopt(int level, int option, int value);
+    Time const& timeout() const { return timeout_; }
+    void timeoutIs(Time const& timeout); // Max wait per blocking operation
+    Time const& deadline() const { return deadline_; }
+    void deadlineIs(Time const& deadline); // Time by which operations must end
 
 protected:
     Socket(SocketHandle sd, char const* bogus);
     SocketHandle acceptRaw();
 
 private:
+    // Readiness tracking for the epoll/kqueue backends.  The socket is
+    // registered with the hub once, in edge-triggered mode, the first time an
+    // operation would block.  From then on, the hub sets the cached readiness
+    // flags when an edge arrives, and the flags are cleared when a syscall
+    // returns EAGAIN; while a flag is clear, the socket blocks right away
+    // instead of issuing a syscall that is known to fail.
+    void readableIs(bool readable);
+    void writableIs(bool writable);
+    void waitReadable(); // Block until the hub reports the fd readable
+    void waitWritable(); // Block until the hub reports the fd writable
+    void watch(); // Register the fd with the hub (once)
+    void unwatch(); // Deregister the fd, if nothing is waiting on it
+    void deregister(); // Deregister the fd unconditionally, ignoring errors
+
+    // Deadlines.  A blocking operation arms the read or write timer the first
+    // time it has to wait; if the timer fires first, the operation is woken
+    // up (and cancelled, for completion-based backends) and throws a
+    // SocketTimeoutException.
+    class Deadline {
+    // Scope of a blocking operation; cancels the timer when the scope exits.
+    public:
+        Deadline(Timer& timer, bool& timedOut) : timer_(timer) {
+            timedOut = false;
+        }
+        ~Deadline();
+    private:
+        Timer& timer_;
+    };
+    void deadlineArm(Timer& timer); // Arms 'timer' for the current operation
+    void readTimeout(); // Called by readTimer_
+    void writeTimeout(); // Called by writeTimer_
+
     SocketHandle sd_;
+    Coroutine* reader_; // Coroutine blocked until readable, or null
+    Coroutine* writer_; // Coroutine blocked until writable, or null
+    bool readable_;
+    bool writable_;
+    bool watched_;
+    Time timeout_;
+    Time deadline_;
+    Timer readTimer_; // Deadline of the pending read, accept or recv
+    Timer writeTimer_; // Deadline of the pending write, connect or send
+    bool readTimedOut_;
+    bool writeTimedOut_;
+#if defined(_WIN32)
+    Overlapped* readOp_; // Pending operations, so that they can be cancelled
+    Overlapped* writeOp_;
+#elif defined(CORO_IO_URING)
+    Completion* readOp_; // Pending operations, so that they can be cancelled
+    Completion* writeOp_;
+#endif
+
+    friend class Hub;
 };
 
 }
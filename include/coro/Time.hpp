@@ -28,33 +28,38 @@
 namespace coro {
 
 class Time {
+// A time or duration, in nanoseconds.  Time::now() reads a monotonic clock
+// whose epoch is arbitrary (typically boot), so times are only meaningful
+// relative to each other; they're unaffected by changes to the wall clock.
 public:
     Time() : Time(0) {}
-    static Time sec(double sec) { return Time((int64_t)(sec*1000000)); }
-    static Time millisec(int64_t ms) { return Time(ms*1000); }
-    static Time microsec(int64_t us) { return Time(us); }
-    static Time now();
-
-    bool operator<(Time const& rhs) const { return microsec_ < rhs.microsec_; }
-    bool operator>(Time const& rhs) const { return microsec_ > rhs.microsec_; }
-    bool operator==(Time const& rhs) const { return microsec_ == rhs.microsec_; }
+    static Time sec(double sec) { return Time((int64_t)(sec*1000000000)); }
+    static Time millisec(int64_t ms) { return Time(ms*1000000); }
+    static Time microsec(int64_t us) { return Time(us*1000); }
+    static Time nanosec(int64_t ns) { return Time(ns); }
+    static Time now(); // Monotonic clock
+
+    bool operator<(Time const& rhs) const { return nanosec_ < rhs.nanosec_; }
+    bool operator>(Time const& rhs) const { return nanosec_ > rhs.nanosec_; }
+    bool operator==(Time const& rhs) const { return nanosec_ == rhs.nanosec_; }
     bool operator<=(Time const& rhs) const { return !operator>(rhs); }
     bool operator>=(Time const& rhs) const { return !operator<(rhs); }
     bool operator!=(Time const& rhs) const { return !operator==(rhs); }
-    Time operator-(Time const& rhs) const { return Time(microsec_ - rhs.microsec_); }
-    Time operator+(Time const& rhs) const { return Time(microsec_ + rhs.microsec_); }
-    Time& operator+=(Time const& rhs) { microsec_ += rhs.microsec_; return *this; }
-    Time& operator-=(Time const& rhs) { microsec_ -= rhs.microsec_; return *this; }
+    Time operator-(Time const& rhs) const { return Time(nanosec_ - rhs.nanosec_); }
+    Time operator+(Time const& rhs) const { return Time(nanosec_ + rhs.nanosec_); }
+    Time& operator+=(Time const& rhs) { nanosec_ += rhs.nanosec_; return *this; }
+    Time& operator-=(Time const& rhs) { nanosec_ -= rhs.nanosec_; return *this; }
 
 #ifndef _WIN32
     struct timespec timespec() const;
 #endif
-    int64_t millisec() const { return microsec_/1000; }
-    int64_t microsec() const { return microsec_; }
-    double sec() const { return (double)microsec_/1000000.; }
+    int64_t millisec() const { return nanosec_/1000000; }
+    int64_t microsec() const { return nanosec_/1000; }
+    int64_t nanosec() const { return nanosec_; }
+    double sec() const { return (double)nanosec_/1000000000.; }
 private:
-    Time(int64_t microsec) : microsec_(microsec) {}
-    int64_t microsec_;
+    Time(int64_t nanosec) : nanosec_(nanosec) {}
+    int64_t nanosec_;
 };
 
 }
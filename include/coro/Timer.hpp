@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "coro/Common.hpp"
+#include "coro/Time.hpp"
+
+namespace coro {
+
+class TimerWheel;
+
+class Timer {
+// A callback that runs at a given time.  Timers are intrusive: the links live
+// in the timer itself, so scheduling and cancelling one never allocates.  A
+// timer is cancelled automatically when it's destroyed.
+public:
+    Timer(std::function<void()> const& func);
+    ~Timer();
+    Time const& time() const { return time_; }
+    bool pending() const { return wheel_ != 0; }
+
+private:
+    Timer(Timer const&);
+    Timer& operator=(Timer const&);
+
+    std::function<void()> func_;
+    Time time_;
+    Timer* next_;
+    Timer* prev_;
+    Timer** slot_; // List this timer is on
+    TimerWheel* wheel_; // Wheel this timer is scheduled on, if any
+    friend class TimerWheel;
+};
+
+class TimerWheel {
+// Hierarchical timing wheel with a 1us tick.  There are 8 levels of 64 slots;
+// each level covers 64 times the span of the level below it, for a total
+// range of 2^48us (about 9 years).  A timer goes into the level of the
+// highest 6-bit digit in which its expiry differs from the wheel's current
+// time, so inserting and cancelling are O(1).  When advance() reaches a
+// slot, its timers either expire or cascade down to a finer level.  Each
+// level keeps a bitmap of non-empty slots, so advance() only visits slots
+// that hold timers, and next() finds the next slot to visit with a couple of
+// bit operations per level.
+public:
+    enum { LEVELS = 8, SLOTS = 64, BITS = 6 };
+
+    TimerWheel();
+    ~TimerWheel();
+    void timerIs(Timer* timer, Time const& time); // (Re)schedules 'timer'
+    void timerDel(Timer* timer); // Cancels 'timer'; no-op if it isn't pending
+    void advance(Time const& now); // Runs the callbacks of expired timers
+    Time next() const; // Earliest time that advance() may need to run
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+private:
+    TimerWheel(TimerWheel const&);
+    TimerWheel& operator=(TimerWheel const&);
+
+    void insert(Timer* timer);
+    void link(Timer** slot, Timer* timer);
+    void unlink(Timer* timer);
+
+    Timer* slot_[LEVELS][SLOTS];
+    uint64_t pending_[LEVELS]; // Bitmap of non-empty slots for each level
+    Timer* expired_; // Timers that were already due when scheduled
+    uint64_t now_; // Current time of the wheel, in ticks
+    size_t size_;
+};
+
+}
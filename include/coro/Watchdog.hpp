@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "coro/Common.hpp"
+#include "coro/Time.hpp"
+#include <condition_variable>
+#include <thread>
+
+namespace coro {
+
+struct Stall {
+// An event loop stall found by a Watchdog.  'coroutine' is the coroutine that
+// was RUNNING, or null if the hub itself was stuck (e.g., in a timer callback
+// or a posted closure).  It may have exited by the time the report is read,
+// so it's only good for identifying the culprit.
+    Hub* hub;
+    Coroutine* coroutine;
+    Time duration; // Time the loop had gone without progress (at least)
+    std::vector<std::string> backtrace; // Hub thread's stack (Linux only)
+};
+
+typedef std::function<void(Stall const&)> StallHandler;
+void stallPrint(Stall const& stall); // Default StallHandler; prints to stderr
+
+class Watchdog {
+// Thread that watches a hub's event loop for stalls.  The hub bumps a counter
+// every loop iteration and coroutine switch; if the counter stops moving for
+// 'threshold' while the hub's thread is in run() but not waiting in poll(),
+// the watchdog reports the stall once (until the loop moves again).  Time the
+// thread spends outside run() isn't watched.  On Linux, it first signals the
+// hub's thread, which records a backtrace of whatever it's stuck in.  Create
+// watchdogs with Hub::watchdogIs(), from the hub's thread.
+public:
+    Watchdog(Hub* hub, Time const& threshold, StallHandler const& handler);
+    ~Watchdog(); // Stops the watchdog thread
+
+private:
+    void run();
+    void backtrace(Stall& stall);
+#ifdef __linux__
+    static void traceHandler(int signo, siginfo_t* info, void* context);
+#endif
+
+    Hub* hub_;
+    Time threshold_;
+    StallHandler handler_;
+#ifdef __linux__
+    pthread_t hubThread_;
+#endif
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool done_;
+    std::thread thread_;
+};
+
+}
@@ -28,7 +28,10 @@
 #include "Error.hpp"
 #include "Event.hpp"
 #include "Hub.hpp"
+#include "Scheduler.hpp"
 #include "Selector.hpp"
 #include "Socket.hpp"
 #include "SslSocket.hpp"
 #include "Time.hpp"
+#include "Timer.hpp"
+#include "Watchdog.hpp"
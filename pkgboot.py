@@ -199,13 +199,19 @@ class Package:
             assert not "Unknown build type"
 
         self.env['CXX'] = 'clang++'
-        self.env.Append(CXXFLAGS='-std=c++11 -stdlib=libc++ -g -Wall -Werror -fPIC')
+        self.env.Append(CXXFLAGS='-std=c++11 -g -Wall -Werror -fPIC')
         for framework in self.frameworks:
             self.env.Append(LINKFLAGS='-framework %s' % framework)
-        self.env.Append(LINKFLAGS='-stdlib=libc++')
+        if self.env['PLATFORM'] == 'darwin':
+            self.env.Append(CXXFLAGS='-stdlib=libc++')
+            self.env.Append(LINKFLAGS='-stdlib=libc++')
         self.env.Append(BUILDERS={'Pch': Builder(action=build_pch)})
-        self.src += self.env.Glob('build/src/**.s')
-        # Add gas assembly files
+        if self.env['PLATFORM'] == 'darwin':
+            asm = self.env.Glob('build/src/**.s')
+            self.src += filter(lambda x: not x.name.endswith('.elf.s'), asm)
+        else:
+            self.src += self.env.Glob('build/src/**.elf.s')
+        # Add gas assembly files (Mach-O on OS X, ELF everywhere else)
 
         self._setup_build()
 
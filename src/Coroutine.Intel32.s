@@ -26,9 +26,6 @@
 .MODEL flat, C
 .STACK 100h
 
-.DATA
-EXTERN coroCurrent:DWORD
-
 .CODE
 coroSwapContext PROC ; (from, to)
     ; Resume the coroutine passed in as the first argument by saving the state
@@ -44,8 +41,8 @@ coroSwapContext PROC ; (from, to)
     ; rsp+0  return address
     mov eax, [esp+8] ; Load 'to'
     mov ecx, [esp+4] ; Load 'from'
-    mov [coroCurrent], eax
-    ; Set the 'current coroutine' equal to ARG1
+    ; coroCurrent is thread-local; Coroutine::swap() sets it before calling
+    ; this function.
 
     push ebp
     push eax
@@ -26,9 +26,6 @@
 ;.MODEL flat, C
 ;.STACK 100h
 
-.DATA
-EXTERN coroCurrent:QWORD
-
 .CODE
 coroSwapContext PROC ; (from, to)
     ; Resume the coroutine passed in as the first argument by saving the state
@@ -42,8 +39,8 @@ coroSwapContext PROC ; (from, to)
     ; rcx  to
     ; rdx  from
     ; rsp+0  return address
-    mov [coroCurrent], rdx
-    ; Set the 'current coroutine' equal to to
+    ; coroCurrent is thread-local; Coroutine::swap() sets it before calling
+    ; this function.
 
     push rbp
     push rax
@@ -22,38 +22,37 @@
 
 namespace coro {
 
-/*
 static struct sigaction sigsegv;
 static struct sigaction sigbus;
-static char signalstack[SIGSTKSZ];
 
 void fault(int signo, siginfo_t* info, void* context) {
-    if (signo != SIGBUS && signo != SIGSEGV) {
-        abort();
-    }
-    uint64_t start = (uint64_t)coroCurrent->stack_.begin();
-    uint64_t end = (uint64_t)coroCurrent->stack_.end();
-    uint64_t addr = (uint64_t)info->si_addr;
-    if (addr < start || addr >= end) {
-        if (signo == SIGBUS) {
-            struct sigaction self;
-            sigaction(SIGBUS, &sigbus, &self);
-            raise(SIGBUS);
-        } else if (signo == SIGSEGV) {
-            struct sigaction self;
-            sigaction(SIGSEGV, &sigsegv, &self);
-            raise(SIGSEGV);
+// Catches coroutine stack overflows: faults in the guard region below the
+// running coroutine's stack.  The coroutine can't be unwound from there, so
+// report the overflow and abort.  Runs on the thread's alternate signal stack,
+// since the faulting stack is full.  Other faults go to the previous handler.
+    Coroutine* const current = coroCurrent;
+    uint8_t* const addr = (uint8_t*)info->si_addr;
+    if (current && !current->isMain()) {
+        uint8_t* const begin = current->stack().begin();
+        if (addr < begin && addr >= begin-CORO_STACK_GUARD_SIZE) {
+            static char const message[] = "coro: coroutine stack overflow\n";
+            if (write(2, message, sizeof(message)-1)) {}
+            abort();
         }
+    }
+    struct sigaction const& prev = (signo == SIGBUS) ? sigbus : sigsegv;
+    if (prev.sa_flags & SA_SIGINFO) {
+        prev.sa_sigaction(signo, info, context);
+    } else if (prev.sa_handler == SIG_DFL || prev.sa_handler == SIG_IGN) {
+        // Restore the old disposition; the fault recurs when the handler
+        // returns, and takes the default action.
+        sigaction(signo, &prev, 0);
     } else {
-        coroCurrent->commit(addr);
+        prev.sa_handler(signo);
     }
 }
-*/
 
-void registerSignalHandlers() {
-    // Set up the signal handlers for SIGBUS/SIGSEGV to catch stack protection
-    // errors and grow the stack when it runs out of space.
-/*
+static void registerFaultHandler() {
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sigfillset(&sa.sa_mask);
@@ -61,13 +60,94 @@ void registerSignalHandlers() {
     sa.sa_flags = SA_SIGINFO|SA_ONSTACK;
     sigaction(SIGSEGV, &sa, &sigsegv);
     sigaction(SIGBUS, &sa, &sigbus); 
-  
-    stack_t stack;
-    stack.ss_sp = signalstack;
-    stack.ss_flags = 0;
-    stack.ss_size = sizeof(signalstack);
-    sigaltstack(&stack, 0);
-*/
+}
+
+class SignalStack {
+// Per-thread alternate stack for signal handlers, so that fault() can run
+// when a coroutine has overflowed its stack.
+public:
+    SignalStack() : data_(0) {
+        stack_t stack;
+        memset(&stack, 0, sizeof(stack));
+        if (sigaltstack(0, &stack) == 0 && !(stack.ss_flags & SS_DISABLE)) {
+            return; // The thread already has one
+        }
+        size_ = std::max<size_t>(65536, SIGSTKSZ);
+        data_ = (uint8_t*)malloc(size_);
+        stack.ss_sp = data_;
+        stack.ss_flags = 0;
+        stack.ss_size = size_;
+        if (sigaltstack(&stack, 0) < 0) {
+            abort();
+        }
+    }
+    ~SignalStack() {
+        if (!data_) {
+            return;
+        }
+        stack_t stack;
+        memset(&stack, 0, sizeof(stack));
+        stack.ss_flags = SS_DISABLE;
+        sigaltstack(&stack, 0);
+        free(data_);
+    }
+private:
+    uint8_t* data_;
+    size_t size_;
+};
+
+#ifdef __linux__
+static struct sigaction sigpreempt;
+
+static void preemptTick(int signo, siginfo_t* info, void* context) {
+// Counts a tick of the preemption timer for the thread it belongs to (see
+// Hub::preemptIs()).  The handler only bumps a counter: the coroutine is
+// switched out later, at a checkpoint(), because the interrupted code may be
+// in the middle of malloc(), a reference count update, etc.  The counter's
+// address travels in the timer's signal value, so there's no TLS lookup here.
+    if (info->si_code == SI_TIMER && info->si_value.sival_ptr) {
+        auto ticks = (volatile sig_atomic_t*)info->si_value.sival_ptr;
+        *ticks = *ticks+1;
+    } else if (sigpreempt.sa_flags & SA_SIGINFO) {
+        sigpreempt.sa_sigaction(signo, info, context); // Not ours; chain
+    } else if (sigpreempt.sa_handler != SIG_DFL && 
+               sigpreempt.sa_handler != SIG_IGN) {
+        sigpreempt.sa_handler(signo);
+    }
+}
+
+void registerPreemptHandler() {
+// Installs the preemption tick handler, the first time any hub turns on
+// preemption, so that programs that never do keep CORO_PREEMPT_SIGNAL to
+// themselves.  A handler the application installed earlier is chained to.
+// One it installs later replaces preemptTick(); calling preemptIs() again
+// puts preemptTick() back in front of it.
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    struct sigaction cur;
+    if (sigaction(CORO_PREEMPT_SIGNAL, 0, &cur) < 0) {
+        abort();
+    }
+    if ((cur.sa_flags & SA_SIGINFO) && cur.sa_sigaction == preemptTick) {
+        return; // Already installed
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = preemptTick;
+    sa.sa_flags = SA_SIGINFO|SA_RESTART;
+    if (sigaction(CORO_PREEMPT_SIGNAL, &sa, &sigpreempt) < 0) {
+        abort();
+    }
+}
+#endif
+
+void registerSignalHandlers() {
+    // Catch stack overflows.  The handlers are process-wide, but each thread
+    // needs its own alternate signal stack.
+    static std::once_flag faults;
+    std::call_once(faults, registerFaultHandler);
+    static thread_local SignalStack stack;
 }
 
 }
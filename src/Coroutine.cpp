@@ -27,7 +27,8 @@
 #include "coro/Event.hpp"
 
 extern "C" {
-coro::Coroutine* coroCurrent = coro::main().get();
+thread_local coro::Coroutine* coroCurrent = 0; // Set by coro::main()
+thread_local volatile sig_atomic_t coroPreemptTicks = 0; // Set by signal
 }
 
 void coroStart() throw() { coroCurrent->start(); }
@@ -35,7 +36,7 @@ void coroStart() throw() { coroCurrent->start(); }
 #ifdef _WIN32
 #include "Coroutine.win.inl"
 #else
-#include "Coroutine.unix.inl"
+#include "Coroutine.Unix.inl"
 #endif
 
 
@@ -116,40 +117,313 @@ uint64_t pageSize() {
 #endif
 }
 
-Stack::Stack(uint32_t size) : data_(0), size_(size) {
-// Lazily initializes a large stack for the coroutine.  Initially, the
-// coroutine stack is quite small, to lower memory usage.  As the stack grows,
-// the Coroutine::fault handler will commit memory pages for the coroutine.
+static thread_local StackPool* stackPool = 0; // See StackPool::local()
+
+static uint8_t* stackAlloc(uint64_t size) {
+// Reserves a stack, with a no-access guard region of CORO_STACK_GUARD_SIZE
+// bytes below it, so that an overflow faults instead of corrupting the memory
+// below (see fault()).  The OS only backs the pages that the coroutine
+// touches, so resident memory tracks actual stack use.  On Windows, though,
+// the whole stack is committed up front: pages are still only made resident
+// when touched, but each stack counts against the commit limit at its full
+// size.  (Committing on demand behind a PAGE_GUARD page, as thread stacks
+// do, would need the TIB's stack limit and deallocation stack kept up to date
+// across coroutine switches.)
+    uint64_t const guard = CORO_STACK_GUARD_SIZE;
+    assert(guard%pageSize() == 0 && "guard must be a multiple of the page size");
+#ifdef _WIN32
+    auto const base = (uint8_t*)VirtualAlloc(0, size+guard, MEM_RESERVE|MEM_COMMIT,
+        PAGE_READWRITE);
+    if (!base) {
+        throw std::bad_alloc();
+    }
+    DWORD old;
+    if (guard && !VirtualProtect(base, guard, PAGE_NOACCESS, &old)) {
+        abort();
+    }
+#else
+    int flags = MAP_PRIVATE|MAP_ANON|MAP_NORESERVE;
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    int const prot = PROT_READ|PROT_WRITE;
+    auto const base = (uint8_t*)mmap(0, size+guard, prot, flags, -1, 0);
+    if (base == MAP_FAILED) {
+        throw std::bad_alloc(); // Note: each guarded stack uses 2 mappings
+    }
+    if (guard && mprotect(base, guard, PROT_NONE) < 0) {
+        abort();
+    }
+#endif
+    return base+guard;
+}
+
+static void stackFree(uint8_t* data, uint64_t size) {
+    uint64_t const guard = CORO_STACK_GUARD_SIZE;
+#ifdef _WIN32
+    VirtualFree(data-guard, 0, MEM_RELEASE);
+#else
+    munmap(data-guard, size+guard);
+#endif
+}
+
+StackPool::StackPool() :
+    capacity_(CORO_STACK_POOL_SIZE),
+    bytes_(0),
+    hits_(0),
+    misses_(0) {
+// Becomes the calling thread's pool, unless the thread already has one.
+    memset(free_, 0, sizeof(free_));
+    if (!stackPool) {
+        stackPool = this;
+    }
+}
+
+StackPool::~StackPool() {
+    capacityIs(0);
+    if (stackPool == this) {
+        stackPool = 0;
+    }
+}
+
+StackPool* StackPool::local() {
+// Returns the pool of the calling thread's hub, or null if there's no hub (or
+// it's already gone, during thread exit).
+    return stackPool;
+}
+
+int StackPool::sizeClass(uint64_t size) {
+// Returns the smallest size class that fits 'size'; CLASSES or more means
+// it's too big to pool.
+    int shift = MIN_SHIFT;
+    while ((uint64_t(1) << shift) < size) {
+        shift++;
+    }
+    return shift-MIN_SHIFT;
+}
+
+uint8_t* StackPool::alloc(uint64_t& size) {
+    int const index = sizeClass(size);
+    if (index >= CLASSES) {
+        uint64_t const page = pageSize();
+        size = pageRound(size+page-1, page);
+        return stackAlloc(size); // Too big to pool
+    }
+    size = uint64_t(1) << (index+MIN_SHIFT);
+    if (FreeStack* stack = free_[index]) {
+        free_[index] = stack->next;
+        bytes_ -= size;
+        hits_++;
+        return (uint8_t*)stack;
+    }
+    misses_++;
+    return stackAlloc(size);
+}
+
+void StackPool::free(uint8_t* data, uint64_t size) {
+    int const index = sizeClass(size);
+    if (index >= CLASSES || size != uint64_t(1) << (index+MIN_SHIFT) ||
+        bytes_+size > capacity_) {
+        stackFree(data, size); // Not from a pool, or the pool is full
+        return;
+    }
+    FreeStack* stack = (FreeStack*)data;
+    stack->next = free_[index];
+    free_[index] = stack;
+    bytes_ += size;
+}
+
+void StackPool::capacityIs(uint64_t bytes) {
+// Sets the max # of bytes of free stacks to keep, and frees stacks (largest
+// first) until the pool is within it.
+    capacity_ = bytes;
+    for (int i = CLASSES-1; i >= 0 && bytes_ > capacity_; --i) {
+        uint64_t const size = uint64_t(1) << (i+MIN_SHIFT);
+        while (free_[i] && bytes_ > capacity_) {
+            FreeStack* stack = free_[i];
+            free_[i] = stack->next;
+            bytes_ -= size;
+            stackFree((uint8_t*)stack, size);
+        }
+    }
+}
+
+Stack::Stack(uint32_t size, bool pooled) :
+    data_(0),
+    size_(size),
+    pooled_(pooled) {
+// Allocates a stack for the coroutine from the thread's stack pool, which
+// rounds the size up to its size class.  An unpooled stack is only rounded up
+// to a whole number of pages.
     if (size == 0) { return; }
-    data_ = (uint8_t*)malloc(size);
-    assert(data_);
+    StackPool* const pool = pooled ? StackPool::local() : 0;
+    if (pool) {
+        data_ = pool->alloc(size_);
+    } else {
+        uint64_t const page = pageSize();
+        size_ = pageRound(size_+page-1, page);
+        data_ = stackAlloc(size_);
+    }
 }
 
 Stack::~Stack() {
-// Throw exception
-    if (data_) {
-        free(data_);
+// Returns the stack to the pool of the thread that destroys the coroutine,
+// which is normally the thread that created it.
+    if (!data_) {
+        return;
+    }
+    StackPool* const pool = pooled_ ? StackPool::local() : 0;
+    if (pool) {
+        pool->free(data_, size_);
+    } else {
+        stackFree(data_, size_);
+    }
+}
+
+void SharedStack::ownerIs(Coroutine* coro) {
+// Saves the frames of the current owner, which is suspended, and then copies
+// the frames of 'coro' back to the addresses they were saved from.  Called on
+// another stack (the caller's), just before switching to 'coro'.
+    if (owner_ == coro) {
+        return;
+    }
+    if (Coroutine* const owner = owner_) {
+        assert(coroCurrent != owner && "can't save the running coroutine");
+        size_t const size = stack_.end()-owner->stackPointer_;
+        if (size > owner->savedSize_ || size < owner->savedSize_/2) {
+            uint8_t* const saved = (uint8_t*)realloc(owner->saved_, size);
+            if (!saved) {
+                throw std::bad_alloc();
+            }
+            owner->saved_ = saved;
+        }
+        memcpy(owner->saved_, owner->stackPointer_, size);
+        owner->savedSize_ = size;
+    }
+    if (coro) {
+        memcpy(coro->stackPointer_, coro->saved_, coro->savedSize_);
     }
+    owner_ = coro;
 }
 
-Coroutine::Coroutine() : stack_(0) {
+bool SharedStack::contains(void const* addr) {
+    uint8_t const* const ptr = (uint8_t const*)addr;
+    return ptr >= stack_.begin() && ptr < stack_.end();
+}
+
+bool onSharedStack(void const* addr) {
+// Returns true if 'addr' is on the shared stack that the current coroutine is
+// running on.  Such objects are swapped out whenever the coroutine is
+// suspended, so nothing else may refer to them while it's asleep.
+    Coroutine* const current = coroCurrent;
+    return current && current->shared_ && current->shared_->contains(addr);
+}
+
+uint64_t Stack::trim(uint8_t const* sp) {
+// Releases the whole pages of the stack below 'sp', the stack pointer of a
+// suspended coroutine, back to the OS.  Nothing lives there until the
+// coroutine runs again, and then the pages fault back in, zeroed.  Returns
+// the number of those pages that were resident, i.e., how much RSS the trim
+// gave back.
+    uint64_t const page = pageSize();
+    uint8_t* const begin = data_;
+    uint8_t* const end = (uint8_t*)pageRound((uint64_t)sp, page);
+    if (!begin || end <= begin) {
+        return 0;
+    }
+    uint64_t const len = end-begin;
+#ifdef _WIN32
+    VirtualAlloc(begin, len, MEM_RESET, PAGE_READWRITE);
+    return len; // Upper bound; there's no cheap residency check
+#else
+    uint64_t resident = 0;
+#ifdef __APPLE__
+    char vec[64];
+#else
+    unsigned char vec[64];
+#endif
+    for (uint64_t off = 0; off < len; off += sizeof(vec)*page) {
+        uint64_t const chunk = std::min(len-off, (uint64_t)sizeof(vec)*page);
+        if (mincore(begin+off, chunk, vec) < 0) {
+            break;
+        }
+        for (uint64_t i = 0; i < chunk/page; ++i) {
+            resident += (vec[i] & 1) ? page : 0;
+        }
+    }
+    if (madvise(begin, len, MADV_DONTNEED) < 0) {
+        return 0;
+    }
+    return resident;
+#endif
+}
+
+RunQueue::~RunQueue() {
+// Unlinks any coroutines still on the queue, so they don't point at it.
+    while (pop()) {}
+}
+
+Coroutine::Coroutine() :
+    next_(0),
+    prev_(0),
+    queue_(0),
+    stack_(0),
+    timer_([this] { notify(); }),
+    saved_(0),
+    savedSize_(0) {
 // Constructor for the main coroutine.
     status_ = Coroutine::RUNNING;
+    priority_ = Coroutine::NORMAL;
     stackPointer_ = 0;
     event_.reset(new Event);
 }
 
 Coroutine::~Coroutine() {
 // Destroy the coroutine & clean up its stack
-    if (!stack_.begin()) {
+    if (queue_) {
+        queue_->del(this); // Deleted while runnable
+    }
+    if (isMain()) {
         // This is the main coroutine; don't free up anything, because we did
         // not allocate a stack for it.
     } else if (status_ != Coroutine::EXITED && status_ != Coroutine::NEW) {
         assert(status_ != Coroutine::BLOCKED);
+        assert(coroCurrent->isMain() && "must be unwound from the main coroutine");
         status_ = Coroutine::DELETED;
+        main()->status_ = Coroutine::RUNNABLE; // So that exit() can switch back
         swap(); // Allow the coroutine to clean up its stack
         assert(status_ == Coroutine::EXITED);
     }
+    if (shared_ && shared_->owner_ == this) {
+        shared_->owner_ = 0;
+    }
+    free(saved_);
+}
+
+void Coroutine::destroy(Coroutine* coro) {
+// Deletes a coroutine once the last Ptr to it is gone.  A suspended coroutine
+// is unwound by switching to it, and only the main coroutine can do that: if
+// the last Ptr goes away on another coroutine's stack (or the coroutine's
+// own), a direct switch would leave the destroyer suspended with nothing to
+// switch back to it, and two coroutines on the same shared stack can't switch
+// directly at all.  In that case the coroutine is taken off its run queue and
+// handed to the hub, which destroys it at the end of the quiesce() pass.
+//
+// For this to work, a suspended coroutine mustn't keep a Ptr to itself (or
+// to its hub) alive on its own stack, or it can't lose its last owner and be
+// unwound.  So yield(), sleep(), block(), wait() and the Event waits refer to
+// the coroutine and the hub by raw pointer.  block() and wait() do hold one
+// anchor Ptr, and unwind the coroutine when it turns out to be the only one.
+    Coroutine* const current = coroCurrent;
+    if (!current || current->isMain() || coro->status_ == Coroutine::NEW ||
+        coro->status_ == Coroutine::EXITED) {
+        delete coro;
+        return;
+    }
+    if (coro->queue_) {
+        coro->queue_->del(coro);
+    }
+    hub()->reap_.push(coro);
 }
 
 void Coroutine::init(std::function<void()> const& func) {
@@ -158,25 +432,43 @@ void Coroutine::init(std::function<void()> const& func) {
     event_.reset(new Event); 
     func_ = func;
     status_ = Coroutine::NEW;
+    priority_ = Coroutine::NORMAL;
+    next_ = 0;
+    prev_ = 0;
+    queue_ = 0;
+    saved_ = 0;
+    savedSize_ = 0;
     assert((((uint8_t*)this)+2*sizeof(uint8_t*))==(uint8_t*)&stackPointer_);
+    Stack& stack = this->stack();
 
     StackFrame frame;
     memset(&frame, 0, sizeof(frame));
 #ifdef _WIN64
     frame.gs0 = (void*)-1; // Root-level SEH handler
-    frame.gs8 = stack_.end();// Top of stack
-    frame.gs16 = stack_.begin(); // Bottom of stack
+    frame.gs8 = stack.end();// Top of stack
+    frame.gs16 = stack.begin(); // Bottom of stack
 #elif defined(_WIN32) 
     frame.fs0 = (void*)-1; // Root-level SEH handler
-    frame.fs4 = stack_.end();// Top of stack
-    frame.fs8 = stack_.begin(); // Bottom of stack
+    frame.fs4 = stack.end();// Top of stack
+    frame.fs8 = stack.begin(); // Bottom of stack
     // See: http://stackoverflow.com/questions/9249576/seh-setup-for-fibers-with-exception-chain-validation-sehop-active
 #endif
     frame.returnAddr = (void*)coroStart;
 
-    stackPointer_ = stack_.end();
+    stackPointer_ = stack.end();
     stackPointer_ -= sizeof(frame);
-    memcpy(stackPointer_, &frame, sizeof(frame));
+    if (shared_) {
+        // The initial frame waits off the stack until the coroutine first
+        // runs, like the frames of any other suspended shared coroutine.
+        saved_ = (uint8_t*)malloc(sizeof(frame));
+        if (!saved_) {
+            throw std::bad_alloc();
+        }
+        savedSize_ = sizeof(frame);
+        memcpy(saved_, &frame, sizeof(frame));
+    } else {
+        memcpy(stackPointer_, &frame, sizeof(frame));
+    }
 }
 
 void Coroutine::yield() {
@@ -198,6 +490,10 @@ void Coroutine::yield() {
 void Coroutine::block() {
 // Block the current coroutine until some I/O event occurs.  The coroutine will
 // not be rescheduled until explicitly scheduled.
+    if (queue_) {
+        status_ = Coroutine::DELETED; // Lost its last owner; see destroy()
+        throw ExitException();
+    }
 
     // Anchor the coroutine, so that it doesn't get GC'ed while blocked on I/O.
     Ptr<Coroutine> anchor = shared_from_this();
@@ -211,8 +507,14 @@ void Coroutine::block() {
     case Coroutine::NEW: // fallthrough
     default: assert(!"illegal state"); break;
     }
-    hub()->blocked_++;
-    main()->swap();
+    Hub* const hub = coro::hub().get();
+    hub->blocked_++;
+    hub->idle(this);
+    hub->handoff(this)->swap();
+    if (anchor.use_count() == 1) {
+        status_ = Coroutine::DELETED; // Nobody else wants it; unwind
+        throw ExitException();
+    }
 }
 
 void Coroutine::unblock() {
@@ -226,13 +528,37 @@ void Coroutine::unblock() {
     case Coroutine::NEW: // fallthrough
     default: assert(!"illegal state"); break;
     }
+    if (queue_) {
+        queue_->del(this); // Still waiting for its stack to be trimmed
+    }
     hub()->blocked_--;
-    hub()->runnable_.push_back(shared_from_this());
+    hub()->schedule(this);
+}
+
+void Coroutine::priorityIs(Priority priority) {
+// Moves the coroutine to another priority class.  If it's already runnable, it
+// goes to the back of the new class's run queue.  Coroutines on the hub's
+// other queues (handoff, idle, reap) stay where they are.
+    assert(priority >= CRITICAL && priority < PRIORITIES);
+    if (priority == priority_) {
+        return;
+    }
+    priority_ = priority;
+    Hub* const hub = coro::hub().get();
+    RunQueue* const runnable = hub->runnable_;
+    if (queue_ >= runnable && queue_ < runnable+PRIORITIES) {
+        queue_->del(this);
+        hub->schedule(this);
+    }
 }
 
 void Coroutine::wait() {
 // Block the current coroutine until some event occurs.  The coroutine will not
 // be rescheduled until explicitly scheduled.
+    if (queue_) {
+        status_ = Coroutine::DELETED; // Lost its last owner; see destroy()
+        throw ExitException();
+    }
 
     // Anchor the coroutine, so that it doesn't get GC'ed while waiting.
     // FixMe: Should this be the case?  Maybe a waiting coroutine should be
@@ -248,8 +574,14 @@ void Coroutine::wait() {
     case Coroutine::NEW: // fallthrough
     default: assert(!"illegal state"); break;
     }
-    hub()->waiting_++;
-    main()->swap();
+    Hub* const hub = coro::hub().get();
+    hub->waiting_++;
+    hub->idle(this);
+    hub->handoff(this)->swap();
+    if (anchor.use_count() == 1) {
+        status_ = Coroutine::DELETED; // Nobody else wants it; unwind
+        throw ExitException();
+    }
 }
 
 void Coroutine::notify() {
@@ -263,8 +595,12 @@ void Coroutine::notify() {
     case Coroutine::NEW: // fallthrough
     default: assert(!"illegal state"); break;
     }
-    hub()->waiting_--;
-    hub()->runnable_.push_back(shared_from_this());
+    if (queue_) {
+        queue_->del(this); // Still waiting for its stack to be trimmed
+    }
+    Hub* const hub = coro::hub().get();
+    hub->waiting_--;
+    hub->wake(this);
 }
 
 void Coroutine::swap() {
@@ -282,6 +618,13 @@ void Coroutine::swap() {
     case Coroutine::EXITED: assert(!"coroutine is dead"); break;
     default: assert(!"illegal state"); break;
     }
+    if (shared_) {
+        // The frames of the running coroutine can't be saved until the switch
+        // has pushed its registers, so two coroutines on the same shared
+        // stack must always switch by way of some other stack.
+        assert(current->shared_ != shared_ && "switch between shared coroutines");
+        shared_->ownerIs(this);
+    }
     coroCurrent = this;
     coroSwapContext(current, this);
     switch (coroCurrent->status_) {
@@ -312,7 +655,7 @@ void Coroutine::exit() {
 // This function runs when the coroutine "falls of the stack," that is, when it finishes executing.
     assert(coroCurrent == this);
     switch (status_) {
-    case Coroutine::DELETED: break;
+    case Coroutine::DELETED: status_ = Coroutine::EXITED; break; // Unwound
     case Coroutine::RUNNING: status_ = Coroutine::EXITED; break;
     case Coroutine::EXITED: // fallthrough
     case Coroutine::RUNNABLE: // fallthrough
@@ -320,6 +663,9 @@ void Coroutine::exit() {
     default: assert(!"illegal state"); break;
     }
     event_->notifyAll();
+    if (shared_) {
+        shared_->owner_ = 0; // The frames left on the stack are dead
+    }
     main()->swap();
     assert(!"error: coroutine is dead");
 }
@@ -332,27 +678,48 @@ void Coroutine::join() {
 }
 
 Ptr<Coroutine> current() {
-// Returns the coroutine that is currently executing.
+// Returns the coroutine that is currently executing on this thread.
+    if (!coroCurrent) {
+        main();
+    }
     return coroCurrent->shared_from_this();
 }
 
 Ptr<Coroutine> main() {
-// Returns the "main" coroutine (i.e., the main coroutine)
-    static Ptr<Coroutine> main;
+// Returns the "main" coroutine (i.e., the thread's own stack).  Each thread
+// has its own main coroutine, and coroutines never migrate between threads.
+    static thread_local Ptr<Coroutine> main;
     if (!main) {
         main.reset(new Coroutine);
+        coroCurrent = main.get();
         registerSignalHandlers();
     }
     return main;
 }
 
 void yield() {
-    current()->yield();
+    if (!coroCurrent) {
+        main();
+    }
+    coroCurrent->yield();
+}
+
+void preempt() {
+// Yields the current coroutine for checkpoint().  The main coroutine has
+// nothing to yield to, so it just starts a new slice.
+    if (coroCurrent->isMain()) {
+        coroPreemptTicks = 0;
+    } else {
+        yield();
+    }
 }
 
 void sleep(Time const& time) {
-    hub()->timeoutIs(Timeout(time, current()));
-    current()->wait();
+    Coroutine* const coro = coroCurrent;
+    Hub* const hub = coro::hub().get();
+    hub->timerIs(&coro->timer_, Time::now()+time);
+    coro->wait();
+    hub->timerDel(&coro->timer_); // In case something else woke us up
 }
 
 
@@ -47,7 +47,29 @@ void Event::notifyAll() {
 
 void Event::wait() {
     waiter_.push_back(EventRecord(current()));
-    current()->wait();
+    coroCurrent->wait();
+}
+
+bool Event::waitFor(Time const& timeout) {
+    return waitUntil(Time::now()+timeout);
+}
+
+bool Event::waitUntil(Time const& time) {
+// Waits until the event is notified, or until 'time' passes.  Returns true if
+// the event was notified.  Whichever comes first, the other is cleaned up:
+// the coroutine's timer is cancelled, or its wait record is removed, so that
+// neither fires later on a coroutine that has moved on.
+    auto const token = waitToken(current());
+    Coroutine* const coro = coroCurrent;
+    Hub* const hub = coro::hub().get();
+    hub->timerIs(&coro->timer_, time);
+    coro->wait();
+    hub->timerDel(&coro->timer_);
+    if (waitTokenValid(current(), token)) {
+        waitTokenDel(token);
+        return false; // Timed out
+    }
+    return true;
 }
 
 size_t Event::waitToken(Ptr<Coroutine> waiter) {
@@ -66,6 +88,9 @@ bool Event::waitTokenValid(Ptr<Coroutine> waiter, EventWaitToken token) {
 void Event::waitTokenDel(EventWaitToken token) {
     assert(size_t(token) < waiter_.size() && "invalid wait token");
     waiter_[token] = EventRecord();
+    while (!waiter_.empty() && !waiter_.back().coroutine()) {
+        waiter_.pop_back(); // Don't let abandoned waits pile up
+    }
 }
 
 }
@@ -22,41 +22,68 @@
 
 namespace coro {
 
-void Hub::poll() {
-// Poll For I/O events.  If there are pending coroutines, then don't block
-// indefinitely -- just check for any ready I/O.  If there are timers, block
-// only until the min timer is ready.
-    size_t tasks = runnable_.size()+timeout_.size();
-    DWORD timeout = 0;
-    if (!timeout_.empty() && runnable_.empty()) {
-        auto const diff = timeout_.top().time()-Time::now();
-        if (diff > Time::sec(0)) {
-            timeout = DWORD(diff.millisec());
-        }
+typedef ULONG (WINAPI* RtlNtStatusToDosErrorFunc)(LONG status);
+
+DWORD ntStatusToError(ULONG_PTR status) {
+// Converts the NTSTATUS stored in OVERLAPPED::Internal into a Win32 error
+// code, the same way GetQueuedCompletionStatus() does.
+    static RtlNtStatusToDosErrorFunc func = 0;
+    if (!func) {
+        HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+        func = (RtlNtStatusToDosErrorFunc)GetProcAddress(ntdll, "RtlNtStatusToDosError");
+        assert(func);
     }
-    if (tasks <= 0) {
-        timeout = INFINITE;
+    return func(LONG(status));
+}
+
+void Hub::pollInit() {
+// Nothing to do: post() wakes the hub with a packet that has no OVERLAPPED.
+}
+
+void Hub::signal() {
+    if (!PostQueuedCompletionStatus(handle_, 0, 0, 0)) {
+        throw SystemError();
     }
-    if (timeout == 0 && blocked_ == 0) {
-        return;
+}
+
+size_t Hub::harvest(Time const* timeout) {
+// Waits for I/O completions until 'timeout' elapses (forever if 'timeout' is
+// null), and dequeues up to pollBatch() completion packets with one
+// GetQueuedCompletionStatusEx() call.
+    // GetQueuedCompletionStatusEx() has millisecond resolution; round up so
+    // that the loop doesn't spin until the timer expires.
+    DWORD ms = INFINITE;
+    if (timeout) {
+        ms = DWORD((timeout->nanosec()+999999)/1000000);
     }
     SetLastError(ERROR_SUCCESS);
-    ULONG_PTR udata = 0;
-    Overlapped* op = 0;
-    OVERLAPPED** evt = (OVERLAPPED**)&op;
-    DWORD bytes = 0;
-    BOOL ret = GetQueuedCompletionStatus(handle_, (LPDWORD)&bytes, &udata, evt, timeout);
-    if (!op) { return; }
-    if (ret) {
-        op->bytes = bytes;
-        op->error = ERROR_SUCCESS;
-    } else {
-        op->bytes = 0;
-        op->error = GetLastError();
+    ULONG const nevents = ULONG(event_.size());
+    ULONG removed = 0;
+    BOOL ret = GetQueuedCompletionStatusEx(handle_, &event_[0], nevents, &removed, ms, FALSE);
+    if (!ret) {
+        if (WAIT_TIMEOUT != GetLastError()) {
+            throw SystemError();
+        }
+        return 0;
+    }
+    size_t events = size_t(removed);
+    for (ULONG i = 0; i < removed; ++i) {
+        auto const op = (Overlapped*)event_[i].lpOverlapped;
+        if (!op) {
+            events--; // Wakeup from post(); closures run in dispatch()
+            continue;
+        }
+        ULONG_PTR const status = op->overlapped.Internal;
+        op->bytes = event_[i].dwNumberOfBytesTransferred;
+        op->error = (status == 0) ? ERROR_SUCCESS : ntStatusToError(status);
+        if (op->error != ERROR_SUCCESS) {
+            op->bytes = 0;
+        }
+        auto const coro = (Coroutine*)op->coroutine;
+        assert(coro->status()!=Coroutine::EXITED);
+        coro->unblock();
     }
-    auto const coro = (Coroutine*)op->coroutine;
-    assert(coro->status()!=Coroutine::EXITED);
-    coro->unblock();
+    return events;
 }
 
 }
@@ -23,11 +23,18 @@
 #include "coro/Common.hpp"
 #include "coro/Hub.hpp"
 #include "coro/Error.hpp"
+#include "coro/Socket.hpp"
+
+#if defined(__linux__) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid // glibc before 2.35
+#endif
 
 #ifdef __APPLE__
 #include "Hub.osx.inl"
 #elif defined(_WIN32)
 #include "Hub.win.inl"
+#elif defined(CORO_IO_URING)
+#include "Hub.uring.inl"
 #else
 #include "Hub.linux.inl"
 #endif
@@ -35,7 +42,9 @@
 namespace coro {
 
 Ptr<Hub> hub() {
-    static Ptr<Hub> hub(new Hub);
+// Returns the calling thread's hub.  Each thread gets its own independent
+// hub, with its own event loop, poller handle and run queue.
+    static thread_local Ptr<Hub> hub(new Hub);
     return hub;
 }
 
@@ -43,9 +52,38 @@ void run() {
     hub()->run();
 }
 
-Hub::Hub() : blocked_(0), waiting_(0), handle_(0) {
+Hub::Hub() :
+    quiesceBudget_(0),
+    handoffs_(0),
+    handoffMax_(16),
+    stackTrimmed_(0),
+#ifdef __linux__
+    preemptTimerValid_(false),
+#endif
+    trimTimer_([this] { trim(); }),
+    blocked_(0),
+    waiting_(0),
+    handle_(0),
+    pollBatch_(0),
+    pollSkip_(0),
+    pollSkipped_(0),
+    pollSkipMax_(8),
+    pollLatencyMax_(Time::microsec(250)),
+    pollsSkipped_(0),
+    socketBusyPoll_(0),
+    busyPollHits_(0),
+    posted_(0),
+    signaled_(false),
+    beat_(0),
+    active_(0),
+    polling_(false),
+    running_(false) {
 // Creates a new hub to manage I/O and runnable coroutines.  The hub is
 // responsible for scheduling coroutines to run.
+    main(); // Make sure the thread's main coroutine outlives the hub
+    weight_[Coroutine::CRITICAL] = 16;
+    weight_[Coroutine::NORMAL] = 4;
+    weight_[Coroutine::BACKGROUND] = 1;
 #if defined(_WIN32)
     WORD version = MAKEWORD(2, 2);
     WSADATA data;
@@ -57,62 +95,532 @@ Hub::Hub() : blocked_(0), waiting_(0), handle_(0) {
     handle_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 0);
 #elif defined(__APPLE__)
     handle_ = kqueue();
+#elif defined(CORO_IO_URING)
+    handle_ = ring_.fd();
 #elif defined(__linux__)
-    handle_ = epoll_create(1);
+    handle_ = epoll_create1(EPOLL_CLOEXEC);
+    if (handle_ < 0) {
+        throw SystemError();
+    }
 #endif
     if (!handle_) {
         throw SystemError();
     }
+    pollInit();
     now_ = Time::now();
+    timer_.advance(now_); // Start the wheel at the current time
+    pollBatchIs(CORO_POLL_BATCH);
+}
+
+Hub::~Hub() {
+// Frees closures that were posted, but never run.
+    watchdog_.reset();
+    Post* post = posted_.exchange(0);
+    while (post) {
+        Post* next = post->next_;
+        delete post;
+        post = next;
+    }
+#if !defined(_WIN32) && !defined(__APPLE__)
+    ::close(wakeup_);
+#endif
+#if defined(__linux__) && !defined(CORO_IO_URING)
+    ::close(timerfd_);
+#endif
+#ifdef __linux__
+    if (preemptTimerValid_) {
+        timer_delete(preemptTimer_);
+    }
+#endif
 }
 
-void Hub::timeoutIs(Timeout const& timeout) {
-// Schedules a coroutine to run in the future
-    timeout_.push(Timeout(timeout.time()+now_, timeout.coroutine()));
+void Hub::post(std::function<void()> const& func) {
+// Queues 'func' to run on the hub's thread, and wakes the hub up if it's
+// blocked in poll().  This is the only Hub method that may be called from
+// another thread: the closure runs on the hub's main coroutine at the top of
+// the next run() iteration, where it can safely notify events, start
+// coroutines, etc.  Closures run in the order they were posted; they must not
+// block or throw.  Closures posted after run() returns run on the next call
+// to run().
+    Post* post = new Post(func);
+    Post* head = posted_.load(std::memory_order_relaxed);
+    do {
+        post->next_ = head;
+    } while (!posted_.compare_exchange_weak(head, post));
+    if (!signaled_.exchange(true)) {
+        signal(); // Only the first post since the last dispatch() wakes the hub
+    }
+}
+
+void Hub::dispatch() {
+// Runs closures queued by post().  The wakeup flag is cleared before the
+// queue is taken, so a post() that races with dispatch() either lands in this
+// batch, or sees the flag clear and signals the hub again.
+    if (!signaled_.load(std::memory_order_relaxed)) { return; }
+    signaled_ = false;
+    Post* post = posted_.exchange(0);
+    Post* fifo = 0;
+    while (post) {
+        Post* next = post->next_;
+        post->next_ = fifo;
+        fifo = post;
+        post = next;
+    }
+    while (fifo) {
+        Post* next = fifo->next_;
+        fifo->func_();
+        delete fifo;
+        fifo = next;
+    }
+}
+
+void Hub::pollBatchIs(size_t batch) {
+// Sets the max number of I/O events that one call to poll() harvests.  Every
+// harvested event unblocks its coroutine before the next quiesce() pass, so a
+// larger batch means fewer polling syscalls when many connections are active.
+    assert(batch > 0);
+    pollBatch_ = batch;
+#ifndef CORO_IO_URING
+    event_.resize(batch);
+#endif
+}
+
+void Hub::pollSkipMaxIs(size_t iterations, Time const& latency) {
+// Bounds the adaptive poll amortization in run().  While coroutines are
+// runnable, poll() can't block, so it only checks for ready I/O; when those
+// checks keep coming back empty, run() skips them for up to 'iterations' loop
+// iterations, and never for longer than 'latency'.  Zero disables skipping.
+    pollSkipMax_ = iterations;
+    pollLatencyMax_ = latency;
+    pollSkip_ = std::min(pollSkip_, pollSkipMax_);
+}
+
+void Hub::timerIs(Timer* timer, Time const& time) {
+// Schedules 'timer' to run at 'time' (on the Time::now() clock), or moves it
+// if it's already scheduled.  The callback runs on the hub's main coroutine
+// at the top of a run() iteration, so it must not block.  A timer that is
+// destroyed or passed to timerDel() before then never runs.
+    timer_.timerIs(timer, time);
+}
+
+void Hub::timerDel(Timer* timer) {
+    timer_.timerDel(timer);
+}
+
+static inline void prefetch(void const* addr, int lines) {
+// Hints that the cache lines at 'addr' will be needed soon.  The run queue is
+// a linked list, so without a hint, the CPU can't start loading the next
+// coroutine's stack until the current one is done running.
+#ifdef __GNUC__
+    for (int i = 0; i < lines; ++i) {
+        __builtin_prefetch((uint8_t const*)addr+64*i);
+    }
+#endif
+}
+
+inline void Hub::beat() {
+// Only the hub's thread writes beat_, so there's no need for an atomic add.
+    beat_.store(beat_.load(std::memory_order_relaxed)+1,
+        std::memory_order_relaxed);
 }
 
 void Hub::quiesce() {
-// Run coroutines until they are all blocked on I/O or dead.
-    std::vector<WeakPtr<Coroutine>> runnable;
-    runnable.swap(runnable_);
-    for (auto weak : runnable) {
-        auto coroutine = weak.lock();
-        if (!coroutine) { continue; }
-        main()->status_ = Coroutine::RUNNABLE;
-        assert(coroutine->status()!=Coroutine::EXITED);
-        coroutine->swap();
-        switch (coroutine->status()) {
-        case Coroutine::EXITED: break;
-        case Coroutine::DELETED: break;
-        case Coroutine::RUNNABLE:
-            runnable_.push_back(coroutine);
-            break;  
-        case Coroutine::BLOCKED:
-        case Coroutine::WAITING:
+// Run coroutines until they are all blocked on I/O or dead.  Each pass runs
+// only the coroutines that were runnable when it started; coroutines that
+// become runnable during the pass run on the next one.  The priority classes
+// are served in weighted round-robin, highest first: each round runs up to
+// weight() coroutines from each class.  Every class gets at least one round
+// per pass, but once a class has drained its share of the pass and new work
+// arrived in it, the lower classes stop there; their leftovers keep their
+// place at the head of the queue, and the pass ends so that the
+// higher-priority work runs sooner.  The pass also ends early when it runs
+// out of budget; see quiesceBudgetIs().  A coroutine is taken off the queue
+// before it runs; if it's destroyed while still queued, it unlinks itself.
+    size_t left[Coroutine::PRIORITIES];
+    bool ran = !handoff_.empty();
+    for (int i = 0; i < Coroutine::PRIORITIES; ++i) {
+        left[i] = runnable_[i].size();
+        ran = ran || left[i];
+    }
+    if (!ran) {
+        return;
+    }
+    bool const timed = quiesceBudgetTime_ > Time();
+    size_t budget = quiesceBudget_ ? quiesceBudget_ : SIZE_MAX;
+    Time const start = timed ? Time::now() : now_;
+    switched_ = start;
+    while (Coroutine* next = handoff_.pop()) {
+        resume(next); // Woken outside of quiesce(); see wake()
+    }
+    for (bool first = true, more = true; more; first = false) {
+        more = false;
+        for (int i = 0; i < Coroutine::PRIORITIES && budget; ++i) {
+            RunQueue& queue = runnable_[i];
+            size_t const count = std::min(left[i], weight_[i]);
+            left[i] -= count;
+            for (size_t n = 0; n < count; ++n) {
+                Coroutine* coroutine = queue.pop();
+                if (!coroutine) {
+                    left[i] = 0; // Queued coroutines were destroyed
+                    break;
+                }
+                if (Coroutine* next = queue.front()) {
+                    prefetch(next->stackPointer_, 3); // Saved registers
+                }
+                handoffs_ = 0;
+                resume(coroutine);
+                bool preempted = coroPreemptTicks > 1;
+                while (Coroutine* next = handoff_.pop()) {
+                    resume(next); // Woken by the last one, while data is hot
+                    preempted = preempted || coroPreemptTicks > 1;
+                }
+                if (preempted) {
+                    budget = 1; // Preempted; check for I/O before going on
+                }
+                if (timed && switched_-start >= quiesceBudgetTime_) {
+                    budget = 1;
+                }
+                if (--budget == 0) {
+                    left[i] += count-n-1; // Unrun; they stay at the head
+                    break;
+                }
+            }
+            if (left[i]) {
+                more = true;
+            } else if (!first && queue.size() > 0) {
+                break; // Defer the lower classes to the next pass
+            }
+        }
+        if (!budget) {
+            // Out of budget: leave the rest for the next pass, and make sure
+            // run() checks for I/O before then, rather than skipping the poll.
+            pollSkip_ = 0;
             break;
-        case Coroutine::NEW: // fallthrough
-        case Coroutine::RUNNING: // fallthrough
-        default: assert(!"illegal coroutine state"); break;
         }
     }
+    if (!reap_.empty()) {
+        reap();
+    }
+    now_ = timed ? switched_ : Time::now(); // Coroutines may have run a while
+}
+
+void Hub::reap() {
+    while (Coroutine* coroutine = reap_.pop()) {
+        delete coroutine;
+    }
+}
+
+void Hub::resume(Coroutine* coroutine) {
+// Runs 'coroutine' until control comes back to the main coroutine, possibly
+// by way of direct handoffs (see handoff()), then requeues the coroutine that
+// switched back if it's still runnable.
+    main()->status_ = Coroutine::RUNNABLE;
+    assert(coroutine->status()!=Coroutine::EXITED);
+    active_.store(coroutine, std::memory_order_relaxed);
+    beat();
+    coroPreemptTicks = 0; // New preemption slice
+    coroutine->swap();
+    Coroutine* const last = active_.load(std::memory_order_relaxed);
+    active_.store(0, std::memory_order_relaxed);
+    account(last);
+    switch (last->status()) {
+    case Coroutine::EXITED: break;
+    case Coroutine::DELETED: break;
+    case Coroutine::RUNNABLE:
+        if (!last->queue_) {
+            schedule(last); // Unless it's waiting to be reaped
+        }
+        break;  
+    case Coroutine::BLOCKED:
+    case Coroutine::WAITING:
+        last->burstTime_ = Time(); // Gave up the CPU
+        break;
+    case Coroutine::NEW: // fallthrough
+    case Coroutine::RUNNING: // fallthrough
+    default: assert(!"illegal coroutine state"); break;
+    }
+}
+
+void Hub::account(Coroutine* coroutine) {
+// Charges the time since the last switch to 'coroutine'.  With a time budget,
+// there's one clock read per switch: the end of one coroutine's run is the
+// start of the next one's.
+    if (quiesceBudgetTime_ > Time()) {
+        Time const now = Time::now();
+        coroutine->runTime_ += now-switched_;
+        coroutine->burstTime_ += now-switched_;
+        switched_ = now;
+    }
+}
+
+void Hub::wake(Coroutine* coroutine) {
+// Makes 'coroutine', which was waiting on an event, runnable.  If the
+// coroutine that quiesce() is running woke it, and it's at least as important
+// as the waker, it goes into the handoff slot instead of the run queue: it
+// runs as soon as the waker gives up the CPU, while the data the waker left
+// for it is still in cache.  At most handoffMax() wakeups per quiesce() run
+// take the slot, so that coroutines passing control back and forth can't
+// keep the hub from polling.  Two coroutines on the same shared stack can't
+// switch directly (see Coroutine::swap()), so they always go through the queue.
+    Coroutine* const current = coroCurrent;
+    if (current == active_.load(std::memory_order_relaxed) && current &&
+        handoff_.empty() && handoffs_ < handoffMax_ &&
+        coroutine->priority_ <= current->priority_ &&
+        !(coroutine->shared_ && coroutine->shared_ == current->shared_)) {
+        handoffs_++;
+        handoff_.push(coroutine);
+    } else {
+        schedule(coroutine);
+    }
+}
+
+Coroutine* Hub::handoff(Coroutine* from) {
+// Returns the coroutine that 'from' switches to as it gives up the CPU by
+// waiting or blocking: the coroutine it woke up, if that one is in the handoff
+// slot, so that the two trade places with one context switch instead of two
+// (through the main coroutine); otherwise, the main coroutine.
+    Coroutine* const to = handoff_.pop();
+    if (!to) {
+        return main().get();
+    }
+    account(from);
+    from->burstTime_ = Time();
+    active_.store(to, std::memory_order_relaxed);
+    beat();
+    coroPreemptTicks = 0; // 'to' gets a slice of its own
+    return to;
+}
+
+void Hub::idle(Coroutine* coroutine) {
+// Notes that 'coroutine' is about to wait or block, if stack trimming is on.
+// Coroutines go idle in time order, so the queue stays sorted by idle time.
+    if (stackTrim_ > Time() && coroutine->stack_.begin()) {
+        coroutine->idled_ = now_;
+        idle_.push(coroutine);
+        if (!trimTimer_.pending()) {
+            timerIs(&trimTimer_, now_+stackTrim_);
+        }
+    }
+}
+
+void Hub::trim() {
+// Releases the stack pages below the stack pointer of each coroutine that has
+// been waiting or blocked for stackTrim() or longer.  A coroutine that once
+// took a deep code path otherwise keeps those pages resident for good.  Each
+// stack is trimmed once per idle period; the coroutine leaves the queue when
+// it's trimmed or woken up.  Runs from a hub timer set for when the
+// longest-idle coroutine is due, so poll() wakes up for it even if the hub
+// has nothing else to do.
+    while (Coroutine* coroutine = idle_.front()) {
+        if (now_-coroutine->idled_ < stackTrim_) {
+            timerIs(&trimTimer_, coroutine->idled_+stackTrim_);
+            return;
+        }
+        idle_.pop();
+        stackTrimmed_ += coroutine->stack_.trim(coroutine->stackPointer_);
+    }
+}
+
+void Hub::stackTrimIs(Time const& idle) {
+// Turns on stack trimming for coroutines that stay idle for 'idle' or longer
+// (see trim()).  Coroutines that are already idle aren't affected.
+    stackTrim_ = idle;
+    if (idle == Time()) {
+        while (idle_.pop()) {}
+        timerDel(&trimTimer_);
+    }
+}
+
+Ptr<SharedStack> Hub::sharedStack() {
+// Returns the stack that the hub's shared-stack coroutines run on.  It's as
+// big as a regular coroutine stack, since any of them may need all of it.
+    if (!sharedStack_) {
+        sharedStack_.reset(new SharedStack(CORO_STACK_SIZE));
+    }
+    return sharedStack_;
+}
+
+void Hub::handoffMaxIs(size_t handoffs) {
+// Sets the max # of direct handoffs (see wake()) in a row.  Zero turns
+// handoffs off, so that every wakeup goes through the run queue.
+    handoffMax_ = handoffs;
+}
+
+size_t Hub::runnable() const {
+    size_t count = handoff_.size();
+    for (int i = 0; i < Coroutine::PRIORITIES; ++i) {
+        count += runnable_[i].size();
+    }
+    return count;
+}
+
+void Hub::quiesceBudgetIs(size_t coroutines, Time const& time) {
+// Bounds the work done by one quiesce() pass to at most 'coroutines'
+// coroutine runs and 'time' of run time (zero means no limit).  When a pass
+// runs out, the coroutines it didn't get to keep their place, and run() polls
+// for I/O before the next pass, so compute-bound coroutines that keep
+// yielding can't hold up I/O readiness for longer than the budget (plus one
+// coroutine's run).  A time budget reads the clock once per switch, which
+// also maintains Coroutine::runTime() and Coroutine::burstTime().
+    quiesceBudget_ = coroutines;
+    quiesceBudgetTime_ = time;
+}
+
+void Hub::watchdogIs(Time const& threshold, StallHandler const& handler) {
+// Starts a watchdog thread that calls 'handler' when the event loop makes no
+// progress for 'threshold' -- typically because a coroutine made a blocking
+// call (e.g., getaddrinfo()) or went into a long loop.  A zero threshold
+// stops the watchdog.  Must be called from the hub's thread.
+    watchdog_.reset();
+    if (threshold > Time()) {
+        watchdog_.reset(new Watchdog(this, threshold, handler));
+    }
+}
+
+void Hub::preemptIs(Time const& slice) {
+// Turns on preemption: a coroutine that has used more than 'slice' of CPU
+// time since it was switched in yields at its next checkpoint(), and the
+// quiesce() pass ends so that run() checks for I/O.  A per-thread CPU-time
+// timer signals the hub's thread every 'slice' (CORO_PREEMPT_SIGNAL), so an
+// idle hub isn't woken up.  Must be called from the hub's thread.  Linux only;
+// elsewhere checkpoint() never yields.
+    preempt_ = slice;
+#ifdef __linux__
+    if (slice > Time()) {
+        registerPreemptHandler();
+    }
+    if (slice > Time() && !preemptTimerValid_) {
+        struct sigevent ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.sigev_notify = SIGEV_THREAD_ID;
+        ev.sigev_signo = CORO_PREEMPT_SIGNAL;
+        ev.sigev_value.sival_ptr = (void*)&coroPreemptTicks;
+        ev.sigev_notify_thread_id = pid_t(syscall(SYS_gettid));
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &ev, &preemptTimer_) < 0) {
+            throw SystemError();
+        }
+        preemptTimerValid_ = true;
+    }
+    if (preemptTimerValid_) {
+        struct itimerspec spec;
+        spec.it_value = slice.timespec();
+        spec.it_interval = spec.it_value;
+        if (timer_settime(preemptTimer_, 0, &spec, 0) < 0) {
+            throw SystemError();
+        }
+    }
+#endif
+}
+
+size_t Hub::weight(Coroutine::Priority priority) const {
+    return weight_[priority];
+}
+
+void Hub::weightIs(Coroutine::Priority priority, size_t weight) {
+// Sets the # of coroutines of class 'priority' that run per round-robin round
+// in quiesce().  Raising a class's weight relative to the others gives it a
+// larger share of each pass while all classes are busy.
+    assert(weight > 0);
+    weight_[priority] = weight;
+}
+
+size_t Hub::poll() {
+// Poll for I/O events.  If there are pending coroutines, then don't block
+// indefinitely -- just check for any ready I/O.  If there are timers, block
+// only until the min timer is ready.  In busy-poll mode, spin on non-blocking
+// checks for up to busyPoll() before falling back to a blocking wait.  The
+// cached clock is only read again if the poll may have waited.
+    Time timeout;
+    bool forever = false;
+    if (runnable() == 0) {
+        if (!timer_.empty()) {
+            timeout = std::max(Time(), timer_.next()-now_);
+        } else {
+            forever = true;
+        }
+    }
+    if (!forever && timeout <= Time() && blocked_ == 0) {
+        return 0; // Nothing to wait for
+    }
+    if (!forever && timeout <= Time()) {
+        return harvest(&timeout); // Just check for ready I/O
+    }
+    if (busyPoll_ > Time()) {
+        Time const start = now_;
+        Time const zero;
+        for (now_ = Time::now(); now_-start < busyPoll_; now_ = Time::now()) {
+            if (!forever && now_-start >= timeout) {
+                return 0; // Timer expired while spinning
+            }
+            if (size_t const events = harvest(&zero)) {
+                busyPollHits_++;
+                return events;
+            }
+        }
+        if (!forever) {
+            timeout = std::max(Time(), timeout-(now_-start));
+        }
+    }
+    size_t const events = harvest(forever ? 0 : &timeout);
+    now_ = Time::now();
+    return events;
+}
+
+void Hub::busyPollIs(Time const& window, int socketBusyPoll) {
+// Trades CPU for latency: before poll() blocks in the kernel, it spins on
+// non-blocking checks for up to 'window', so that I/O arriving during the
+// window is handled without a wakeup.  If 'socketBusyPoll' is non-zero,
+// sockets created afterwards also get SO_BUSY_POLL set to that many
+// microseconds (Linux only).  Raising it above net.core.busy_read needs
+// CAP_NET_ADMIN; without it, sockets are created as usual, just without
+// SO_BUSY_POLL.  A zero window turns busy polling off.
+    busyPoll_ = window;
+    socketBusyPoll_ = socketBusyPoll;
 }
 
 void Hub::run() {
 // Run coroutines and handle I/O until the process exits
     assert(coro::current() == coro::main());
+    // The watchdog only watches the loop while the thread is in it.
+    struct Running {
+        std::atomic<bool>& flag;
+        Running(std::atomic<bool>& flag) : flag(flag) { flag.store(true); }
+        ~Running() { flag.store(false); }
+    } running(running_);
+    now_ = Time::now();
     for (;;) {
-        now_ = Time::now();
-        while (!timeout_.empty() && timeout_.top().time() <= now_) {
-            auto const timeout = timeout_.top();
-            auto const coro = timeout.coroutine();
-            coro->notify();
-            timeout_.pop();
-        }
+        // now_ is kept current by quiesce() and poll(), which refresh it
+        // whenever they may have taken a while.
+        beat();
+        timer_.advance(now_); // Expire timers
+        dispatch();
         quiesce();
-        if (runnable_.size()+blocked_+waiting_ <= 0) {
+        size_t const ready = runnable();
+        if (ready+blocked_+waiting_ <= 0 && !posted_.load()) {
             return; // No more work to be done.
         }
-        poll();
+        if (ready == 0 || blocked_ == 0) {
+            polled_ = now_;
+            polling_.store(true, std::memory_order_relaxed);
+            poll(); // Blocking (or free) poll; never skipped
+            polling_.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        // There's runnable work, so poll() would just check for ready I/O.
+        // Skip the check if recent checks found nothing, as long as I/O
+        // hasn't gone unchecked for too long.
+        if (pollSkipped_ < pollSkip_ && now_-polled_ < pollLatencyMax_) {
+            pollSkipped_++;
+            pollsSkipped_++;
+            continue;
+        }
+        pollSkipped_ = 0;
+        polled_ = now_;
+        if (poll() > 0) {
+            pollSkip_ = 0;
+        } else {
+            pollSkip_ = std::min(std::max<size_t>(1, pollSkip_*2), pollSkipMax_);
+        }
     }
 }
 
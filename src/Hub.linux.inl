@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2013 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+namespace coro {
+
+void Hub::pollInit() {
+// Registers an eventfd with epoll; post() writes to it to wake the hub up.
+// The event's data pointer is null, which sets it apart from socket events.
+// Also registers a timerfd, which harvest() arms for deadlines that fall
+// between the millisecond ticks of epoll_wait().
+    wakeup_ = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (wakeup_ < 0) {
+        throw SystemError();
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN|EPOLLET;
+    event.data.ptr = 0;
+    if (epoll_ctl(handle_, EPOLL_CTL_ADD, wakeup_, &event) < 0) {
+        throw SystemError();
+    }
+    timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timerfd_ < 0) {
+        throw SystemError();
+    }
+    event.data.ptr = &timerfd_;
+    if (epoll_ctl(handle_, EPOLL_CTL_ADD, timerfd_, &event) < 0) {
+        throw SystemError();
+    }
+}
+
+static void timerfdArm(int fd, Time const& expiry) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value = expiry.timespec();
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, 0) < 0) {
+        throw SystemError();
+    }
+}
+
+void Hub::signal() {
+    uint64_t const one = 1;
+    if (write(wakeup_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        throw SystemError();
+    }
+}
+
+size_t Hub::harvest(Time const* timeout) {
+// Waits for I/O events until 'timeout' elapses (forever if 'timeout' is null),
+// and handles up to pollBatch() of them with one epoll_wait() call.
+    int ms = -1;
+    if (timeout) {
+        // epoll_wait() has millisecond resolution.  If the deadline falls
+        // between two ticks, arm the timerfd to wake up exactly on time, and
+        // round up so that epoll_wait() itself is only a backstop.  The timer
+        // is re-armed only when the deadline changes, so a hub pacing at the
+        // same deadline over several polls pays for one syscall.
+        int64_t const ns = timeout->nanosec();
+        ms = int(ns/1000000);
+        if (ns%1000000) {
+            Time const expiry = now_+*timeout;
+            if (expiry != timerfdExpiry_) {
+                timerfdArm(timerfd_, expiry);
+                timerfdExpiry_ = expiry;
+            }
+            ms++;
+        }
+    }
+    int res = epoll_wait(handle_, &event_[0], int(event_.size()), ms);
+    if (res < 0) {
+        if (errno != EINTR) {
+            throw SystemError();
+        }
+        return 0;
+    }
+    size_t events = size_t(res);
+    for (int i = 0; i < res; ++i) {
+        if (event_[i].data.ptr == &timerfd_) {
+            uint64_t count = 0;
+            if (read(timerfd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                throw SystemError();
+            }
+            timerfdExpiry_ = Time();
+            events--; // Expired timers are handled by run()
+            continue;
+        }
+        // Still valid: Socket::close() deletes the registration explicitly.
+        auto const socket = (Socket*)event_[i].data.ptr;
+        uint32_t const flags = event_[i].events;
+        if (!socket) {
+            uint64_t count = 0;
+            if (read(wakeup_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                throw SystemError();
+            }
+            events--; // Posted closures run in dispatch()
+            continue;
+        }
+        // Hang-ups and errors wake both sides, so that the blocked call
+        // sees the error when it retries the syscall.
+        if (flags & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) {
+            socket->readableIs(true);
+        }
+        if (flags & (EPOLLOUT|EPOLLHUP|EPOLLERR)) {
+            socket->writableIs(true);
+        }
+    }
+    return events;
+}
+
+}
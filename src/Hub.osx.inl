@@ -23,35 +23,68 @@
 
 namespace coro {
 
-void Hub::poll() {
-// Poll for I/O events.  If there are pending coroutines, then don't block
-// indefinitely -- just check for any ready I/O.  If there are timers, block
-// only until the min timer is ready.
-    size_t tasks = runnable_.size()+timeout_.size();
-    struct timespec timeout{0};
-    struct kevent event{0};
-
-    if (!timeout_.empty() && runnable_.empty()) {
-        auto const diff = timeout_.top().time()-Time::now();
-        if (diff > Time::sec(0)) {
-            timeout = diff.timespec();
-        }
+void Hub::pollInit() {
+// Adds a user event to the kqueue; post() triggers it to wake the hub up.
+    struct kevent ev;
+    EV_SET(&ev, 0, EVFILT_USER, EV_ADD|EV_CLEAR, 0, 0, 0);
+    if (kevent(handle_, &ev, 1, 0, 0, 0) < 0) {
+        throw SystemError();
     }
-    // Don't sleep if the sleep time is less than 1 us.
-    if (timeout.tv_nsec < 1000 && timeout.tv_sec == 0 && blocked_ == 0) {
-        return;
+}
+
+void Hub::signal() {
+    struct kevent ev;
+    EV_SET(&ev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+    if (kevent(handle_, &ev, 1, 0, 0, 0) < 0) {
+        throw SystemError();
     }
+}
 
-    int res = kevent(handle_, 0, 0, &event, 1, (tasks <= 0 ? 0 : &timeout));
+size_t Hub::harvest(Time const* timeout) {
+// Waits for I/O events until 'timeout' elapses (forever if 'timeout' is null),
+// and handles up to pollBatch() of them with one kevent() call.
+    struct timespec ts{0};
+    struct kevent change;
+    int nchanges = 0;
+    if (timeout && *timeout > Time()) {
+        // The kevent() timeout is subject to timer coalescing, which can make
+        // short waits late by far more than the wait itself.  Instead, queue
+        // a one-shot nanosecond timer with the same kevent() call, and block
+        // until it (or I/O) fires.
+        int fflags = NOTE_NSECONDS;
+#ifdef NOTE_CRITICAL
+        fflags |= NOTE_CRITICAL;
+#endif
+        EV_SET(&change, 0, EVFILT_TIMER, EV_ADD|EV_ONESHOT, fflags,
+            timeout->nanosec(), 0);
+        nchanges = 1;
+        timeout = 0;
+    }
+    int const nevents = int(event_.size());
+    int res = kevent(handle_, &change, nchanges, &event_[0], nevents,
+        (timeout ? &ts : 0));
     if (res < 0) {
-        throw SystemError();
-    } else if (res == 0) {
-        // No events
-    } else {
-        auto const coro = (Coroutine*)event.udata;
-        assert(coro->status()!=Coroutine::EXITED);
-        coro->unblock();
+        if (errno != EINTR) {
+            throw SystemError();
+        }
+        return 0;
+    }
+    size_t events = size_t(res);
+    for (int i = 0; i < res; ++i) {
+        // EV_EOF is reported on the filter itself, so the blocked call sees
+        // the hang-up when it retries the syscall.
+        auto const socket = (Socket*)event_[i].udata;
+        if (event_[i].filter == EVFILT_USER) {
+            events--; // Posted closures run in dispatch()
+        } else if (event_[i].filter == EVFILT_TIMER) {
+            events--; // Expired timers are handled by run()
+        } else if (event_[i].filter == EVFILT_READ) {
+            socket->readableIs(true);
+        } else if (event_[i].filter == EVFILT_WRITE) {
+            socket->writableIs(true);
+        }
     }
+    return events;
 }
 
 }
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2013 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+namespace coro {
+
+IoRing::IoRing(unsigned entries) : pending_(0), sqeTail_(0) {
+// Sets up the io_uring instance and maps the SQ ring, CQ ring and SQE array
+// into the process.  Requires Linux 5.11 or later for IORING_ENTER_EXT_ARG
+// (timed waits) and IORING_FEAT_SINGLE_MMAP.
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+    fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+        throw SystemError();
+    }
+
+    // Undoes the setup if it fails partway.  The exception is built (and errno
+    // read) before the guard runs during unwinding.
+    struct Guard {
+        IoRing* ring;
+        ~Guard() {
+            if (!ring) { return; }
+            if (ring->ring_ != MAP_FAILED) {
+                munmap(ring->ring_, ring->ringSize_);
+            }
+            ::close(ring->fd_);
+        }
+    } guard = { this };
+    ring_ = MAP_FAILED;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG)) {
+        throw SystemError("io_uring: kernel is too old");
+    }
+
+    // The SQ and CQ rings share a single mapping (IORING_FEAT_SINGLE_MMAP).
+    size_t const sqSize = params.sq_off.array+params.sq_entries*sizeof(unsigned);
+    size_t const cqSize = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+    int const prot = PROT_READ|PROT_WRITE;
+    int const flags = MAP_SHARED|MAP_POPULATE;
+    ringSize_ = std::max(sqSize, cqSize);
+    ring_ = mmap(0, ringSize_, prot, flags, fd_, IORING_OFF_SQ_RING);
+    if (ring_ == MAP_FAILED) {
+        throw SystemError();
+    }
+    sqesSize_ = params.sq_entries*sizeof(struct io_uring_sqe);
+    void* sqes = mmap(0, sqesSize_, prot, flags, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        throw SystemError();
+    }
+    sqes_ = (struct io_uring_sqe*)sqes;
+
+    uint8_t* sq = (uint8_t*)ring_;
+    sqHead_ = (unsigned*)(sq+params.sq_off.head);
+    sqTail_ = (unsigned*)(sq+params.sq_off.tail);
+    sqMask_ = *(unsigned*)(sq+params.sq_off.ring_mask);
+    sqEntries_ = *(unsigned*)(sq+params.sq_off.ring_entries);
+    sqeTail_ = *sqTail_;
+
+    // SQEs are always handed out in ring order, so the indirection array is
+    // just the identity mapping.
+    unsigned* array = (unsigned*)(sq+params.sq_off.array);
+    for (unsigned i = 0; i < sqEntries_; ++i) {
+        array[i] = i;
+    }
+
+    uint8_t* cq = (uint8_t*)ring_;
+    cqHead_ = (unsigned*)(cq+params.cq_off.head);
+    cqTail_ = (unsigned*)(cq+params.cq_off.tail);
+    cqMask_ = *(unsigned*)(cq+params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe*)(cq+params.cq_off.cqes);
+    guard.ring = 0;
+}
+
+IoRing::~IoRing() {
+    munmap(sqes_, sqesSize_);
+    munmap(ring_, ringSize_);
+    ::close(fd_);
+}
+
+struct io_uring_sqe* IoRing::sqe() {
+// Returns the next free SQE, or null if the submission queue is full.  The
+// queue only drains when the kernel takes SQEs, so Hub::sqe() handles that.
+    unsigned const head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqeTail_-head >= sqEntries_) {
+        return 0;
+    }
+    struct io_uring_sqe* sqe = &sqes_[sqeTail_ & sqMask_];
+    memset(sqe, 0, sizeof(*sqe));
+    sqeTail_++;
+    pending_++;
+    return sqe;
+}
+
+void IoRing::enter(unsigned wait, Time const* timeout) {
+// Submits all queued SQEs, and waits for at least 'wait' CQEs to arrive.  If
+// 'timeout' is non-null, the wait ends when the timeout elapses.
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    void* argp = 0;
+    size_t argsz = 0;
+    if (wait && timeout) {
+        ts.tv_sec = timeout->nanosec()/1000000000;
+        ts.tv_nsec = timeout->nanosec()%1000000000;
+        arg.ts = (uint64_t)&ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    long ret = syscall(__NR_io_uring_enter, fd_, pending_, wait, flags, argp, argsz);
+    if (ret >= 0) {
+        pending_ -= unsigned(ret);
+    } else if (errno != EINTR && errno != ETIME && errno != EBUSY) {
+        throw SystemError();
+    }
+}
+
+struct io_uring_cqe* IoRing::cqe() {
+    unsigned const head = *cqHead_;
+    if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return &cqes_[head & cqMask_];
+}
+
+void IoRing::cqeDel() {
+    __atomic_store_n(cqHead_, *cqHead_+1, __ATOMIC_RELEASE);
+}
+
+static bool wakeupArm(Hub* hub, int fd, Completion* op, uint64_t* count) {
+// Queues a read on the wakeup eventfd.  It completes when post() writes to
+// the eventfd, which ends any io_uring_enter() wait in progress.  Returns
+// false if there's no room in the submission queue yet.
+    struct io_uring_sqe* sqe = hub->sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)count;
+    sqe->len = sizeof(*count);
+    sqe->user_data = (uint64_t)op;
+    return true;
+}
+
+void Hub::pollInit() {
+    wakeup_ = eventfd(0, EFD_CLOEXEC);
+    if (wakeup_ < 0) {
+        throw SystemError();
+    }
+    wakeupOp_.coroutine = 0;
+    wakeupOp_.result = 0;
+    wakeupArmed_ = wakeupArm(this, wakeup_, &wakeupOp_, &wakeupCount_);
+}
+
+void Hub::signal() {
+    uint64_t const one = 1;
+    if (write(wakeup_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        throw SystemError();
+    }
+}
+
+struct io_uring_sqe* Hub::sqe() {
+// Returns a zeroed SQE to fill in.  If the submission queue is full, submit
+// it, without waiting for completions.  The kernel may take none of it
+// (EBUSY while its completion queue is full, or EAGAIN); then the calling
+// coroutine yields, so that the hub polls and reaps completions, and tries
+// again.  The main coroutine can't yield, so it gets null instead, and has to
+// retry later.
+    struct io_uring_sqe* sqe = ring_.sqe();
+    while (!sqe) {
+        ring_.enter(0, 0);
+        sqe = ring_.sqe();
+        Coroutine* const current = coroCurrent;
+        if (sqe || !current || current->isMain()) {
+            break;
+        }
+        coro::yield();
+        sqe = ring_.sqe();
+    }
+    return sqe;
+}
+
+size_t Hub::harvest(Time const* timeout) {
+// Submits queued I/O operations, waits for completions until 'timeout'
+// elapses (forever if 'timeout' is null), and reaps up to pollBatch() of them.
+    if (!wakeupArmed_) {
+        wakeupArmed_ = wakeupArm(this, wakeup_, &wakeupOp_, &wakeupCount_);
+    }
+    unsigned const wait = (!timeout || *timeout > Time()) ? 1 : 0;
+    ring_.enter(wait, timeout);
+    return complete(pollBatch_);
+}
+
+size_t Hub::complete(size_t max) {
+// Stores the results of up to 'max' ready CQEs, and unblocks their coroutines.
+// Returns the # of I/O completions among them, not counting wakeups and
+// cancellations.
+    size_t events = 0;
+    for (size_t i = 0; i < max; ++i) {
+        struct io_uring_cqe* cqe = ring_.cqe();
+        if (!cqe) { break; }
+        auto const op = (Completion*)cqe->user_data;
+        if (!op) {
+            ring_.cqeDel(); // Result of a cancel request
+            continue;
+        }
+        op->result = cqe->res;
+        ring_.cqeDel();
+        if (op == &wakeupOp_) {
+            wakeupArmed_ = wakeupArm(this, wakeup_, &wakeupOp_, &wakeupCount_);
+            continue; // Posted closures run in dispatch()
+        }
+        auto const coro = op->coroutine;
+        assert(coro->status()!=Coroutine::EXITED);
+        coro->unblock();
+        events++;
+    }
+    return events;
+}
+
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "coro/Common.hpp"
+#include "coro/Scheduler.hpp"
+#include "coro/Coroutine.hpp"
+#include "coro/Hub.hpp"
+
+namespace coro {
+
+static thread_local Scheduler* scheduler = 0; // Scheduler of this worker
+static thread_local size_t worker = 0; // Index of this worker
+
+Scheduler::Scheduler(size_t workers) :
+    queued_(0),
+    next_(0),
+    steals_(0),
+    joining_(false) {
+// Starts the worker threads.  Each worker runs a hub with a dispatcher
+// coroutine that feeds it tasks.
+    workers = std::max(size_t(1), workers);
+    for (size_t i = 0; i < workers; ++i) {
+        worker_.push_back(Ptr<Worker>(new Worker));
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        worker_[i]->thread = std::thread([this, i] {
+            scheduler = this;
+            worker = i;
+            worker_[i]->hub = hub();
+            auto dispatcher = coro::start([this, i] { dispatch(i); });
+            coro::run();
+            scheduler = 0;
+        });
+    }
+}
+
+Scheduler::~Scheduler() {
+    join();
+}
+
+void Scheduler::start(Task const& task) {
+// Queues a task.  Tasks started from a worker go to the back of that worker's
+// deque, so that related work tends to stay on the same core; tasks started
+// from outside the pool are spread across the workers.
+    assert((!joining_ || scheduler == this) && "scheduler is shutting down");
+    size_t const id = (scheduler == this) ? worker : (next_++ % worker_.size());
+    Worker& target = *worker_[id];
+    {
+        std::lock_guard<std::mutex> lock(target.mutex);
+        target.task.push_back(task);
+        queued_++;
+    }
+    wake(id);
+}
+
+void Scheduler::join() {
+// Waits until every queued task has run to completion, then stops the
+// workers.  Must not be called from a worker.
+    assert(scheduler != this && "can't join the scheduler from a worker");
+    joining_ = true;
+    for (size_t i = 0; i < worker_.size(); ++i) {
+        wake(i);
+    }
+    for (auto worker : worker_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+bool Scheduler::pop(size_t id, Task& task) {
+// Takes the newest task from the worker's own deque.
+    Worker& self = *worker_[id];
+    std::lock_guard<std::mutex> lock(self.mutex);
+    if (self.task.empty()) { return false; }
+    task = self.task.back();
+    self.task.pop_back();
+    queued_--;
+    return true;
+}
+
+bool Scheduler::steal(size_t id, Task& task) {
+// Takes the oldest task from the first other worker that has one.
+    for (size_t i = 1; i < worker_.size(); ++i) {
+        Worker& victim = *worker_[(id+i) % worker_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.task.empty()) { continue; }
+        task = victim.task.front();
+        victim.task.pop_front();
+        queued_--;
+        steals_++;
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::wake(size_t id) {
+// Wakes one idle worker, preferring worker 'id'.  The idle flag is claimed
+// with a compare-and-swap, so each idle period costs at most one post().
+    for (size_t i = 0; i < worker_.size(); ++i) {
+        Worker& target = *worker_[(id+i) % worker_.size()];
+        bool idle = true;
+        if (target.idle.compare_exchange_strong(idle, false)) {
+            Worker* const w = &target;
+            target.hub->post([w] { w->event.notifyAll(); });
+            return;
+        }
+    }
+}
+
+static void reap(std::vector<Ptr<Coroutine>>& live) {
+// Drops the references to coroutines that have exited.
+    live.erase(std::remove_if(live.begin(), live.end(), [](Ptr<Coroutine> const& c) {
+        return c->status() == Coroutine::EXITED;
+    }), live.end());
+}
+
+void Scheduler::dispatch(size_t id) {
+// Feeds tasks to this worker's hub.  A task is only started when nothing
+// else on the hub is runnable, so a busy worker leaves its queued tasks for
+// idle workers to steal.  When there's nothing to run anywhere, the
+// dispatcher waits on the worker's event until start() or join() wakes it.
+// During join(), a worker keeps dispatching until its own tasks have exited,
+// since they may still start more; each task that exits wakes it to check.
+    Worker& self = *worker_[id];
+    std::vector<Ptr<Coroutine>> live; // Tasks started on this worker
+    size_t prune = 64;
+    for (;;) {
+        if (hub()->runnable() > 0) {
+            coro::yield(); // Busy; let other coroutines (and workers) run
+            continue;
+        }
+        if (live.size() >= prune) {
+            reap(live);
+            prune = std::max(size_t(64), 2*live.size());
+        }
+        Task task;
+        if (pop(id, task) || steal(id, task)) {
+            Worker* const w = &self;
+            live.push_back(hub()->start([this, w, task] {
+                task();
+                if (joining_) {
+                    w->event.notifyAll();
+                }
+            }));
+            coro::yield();
+            continue;
+        }
+        reap(live);
+        if (joining_ && queued_ == 0 && live.empty()) {
+            break;
+        }
+        // Publish the idle flag before checking for work one last time, so
+        // that a concurrent start() either sees the flag or its task is seen
+        // here.
+        self.idle = true;
+        if (queued_ > 0 || (joining_ && live.empty())) {
+            bool idle = true;
+            if (self.idle.compare_exchange_strong(idle, false)) {
+                continue;
+            }
+            // A waker claimed the flag; its notification is on the way.
+        }
+        self.event.wait();
+        self.idle = false;
+    }
+}
+
+}
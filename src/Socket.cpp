@@ -30,12 +30,26 @@
 #include "Socket.osx.inl"
 #elif defined(_WIN32)
 #include "Socket.win.inl"
+#elif defined(CORO_IO_URING)
+#include "Socket.uring.inl"
 #else
 #include "Socket.linux.inl"
 #endif
 
 namespace coro {
 
+static void busyPollInit(SocketHandle sd) {
+// Sets SO_BUSY_POLL on a new socket if the hub asks for it (see
+// Hub::busyPollIs()).  Best-effort: without CAP_NET_ADMIN, Linux refuses
+// values above net.core.busy_read, and then the socket just doesn't busy-poll.
+#ifdef SO_BUSY_POLL
+    int const value = hub()->socketBusyPoll();
+    if (value > 0) {
+        ::setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, (char*)&value, sizeof(value));
+    }
+#endif
+}
+
 struct in_addr SocketAddr::inaddr() const {
 // Attempts to translate from the input string as if it were a dotted quad
 // first.  If this fails, then assume that the address string is a DNS name,
@@ -74,9 +88,29 @@ struct sockaddr_in SocketAddr::sockaddr() const {
     return sin;
 }
 
-Socket::Socket(int type, int protocol) : sd_(0) {
+Socket::Socket(int type, int protocol) :
+    sd_(0),
+    reader_(0),
+    writer_(0),
+    readable_(true),
+    writable_(true),
+    watched_(false),
+    readTimer_([this] { readTimeout(); }),
+    writeTimer_([this] { writeTimeout(); }),
+    readTimedOut_(false),
+    writeTimedOut_(false) {
+#if defined(_WIN32) || defined(CORO_IO_URING)
+    readOp_ = 0;
+    writeOp_ = 0;
+#endif
 // Creates a new socket; throws a socket exception if creation fails
+    assert(!onSharedStack(this) && "socket must not be on a shared stack");
     hub(); // Make sure the hub is active
+#if defined(CORO_IO_URING)
+    type |= SOCK_CLOEXEC; // io_uring does the non-blocking attempt itself
+#elif defined(__linux__)
+    type |= SOCK_NONBLOCK|SOCK_CLOEXEC;
+#endif
     sd_ = socket(AF_INET, type, protocol);
     if(sd_<0) {
         throw SystemError();
@@ -85,25 +119,57 @@ Socket::Socket(int type, int protocol) : sd_(0) {
     if(!CreateIoCompletionPort((HANDLE)sd_, hub()->handle(), 0, 0)) {
         throw SystemError();
     }
-#else
+#elif defined(__APPLE__)
     setsockopt(SOL_SOCKET, SO_NOSIGPIPE, true);    
     // Don't send SIGPIPE for this socket; handle the write() error instead.
+    if (fcntl(sd_, F_SETFL, O_NONBLOCK) < 0) {
+        throw SystemError();
+    }
+    // Non-blocking, so that connect/accept/send/recv can be tried right away.
 #endif
+    busyPollInit(sd_);
 }
 
-Socket::Socket(SocketHandle sd, char const* /* bogus */) : sd_(sd) {
+Socket::Socket(SocketHandle sd, char const* /* bogus */) :
+    sd_(sd),
+    reader_(0),
+    writer_(0),
+    readable_(true),
+    writable_(true),
+    watched_(false),
+    readTimer_([this] { readTimeout(); }),
+    writeTimer_([this] { writeTimeout(); }),
+    readTimedOut_(false),
+    writeTimedOut_(false) {
+#if defined(_WIN32) || defined(CORO_IO_URING)
+    readOp_ = 0;
+    writeOp_ = 0;
+#endif
+    assert(!onSharedStack(this) && "socket must not be on a shared stack");
 #ifdef _WIN32
     if(!CreateIoCompletionPort((HANDLE)sd_, hub()->handle(), 0, 0)) {
         throw SystemError();
     }
-#else
+#elif defined(__APPLE__)
     setsockopt(SOL_SOCKET, SO_NOSIGPIPE, true); 
     // Don't send SIGPIPE for this socket; handle the write() error instead.
 #endif
+    busyPollInit(sd_);
 }
 
 Ptr<Socket> Socket::accept() {
-    return Ptr<Socket>(new Socket(acceptRaw(), ""));
+// The new Socket owns the accepted handle, unless its constructor throws.
+    SocketHandle const sd = acceptRaw();
+    try {
+        return Ptr<Socket>(new Socket(sd, ""));
+    } catch (...) {
+#ifdef _WIN32
+        ::closesocket(sd);
+#else
+        ::close(sd);
+#endif
+        throw;
+    }
 }
 
 void Socket::bind(SocketAddr const& addr) {
@@ -126,6 +192,10 @@ void Socket::setsockopt(int level, int option, int value) {
     }
 }
 
+int Socket::fileno() const {
+    return int(sd_);
+}
+
 void Socket::writeAll(char const* buf, size_t len, int flags) {
 // Write all data in 'buf'.  Block until all data is written, or the connection
 // is closed.  Throws a SocketCloseException if the connection was closed by
@@ -160,6 +230,64 @@ void Socket::readAll(char* buf, size_t len, int flags) {
     }
 }
 
+void Socket::timeoutIs(Time const& timeout) {
+// Limits how long each blocking operation (read, write, accept, connect) may
+// wait, starting when it first blocks.  Zero means no limit.
+    timeout_ = timeout;
+}
+
+void Socket::deadlineIs(Time const& deadline) {
+// Sets an absolute time (on the Time::now() clock) after which blocking
+// operations throw a SocketTimeoutException instead of waiting.  Useful for
+// bounding a whole request, e.g., a series of readAll() calls.  Zero means no
+// deadline.
+    deadline_ = deadline;
+}
+
+void Socket::deadlineArm(Timer& timer) {
+// Arms 'timer' with the earlier of the socket's deadline and timeout, unless
+// it's already armed for the current operation.
+    if (timer.pending()) { return; }
+    Time when = deadline_;
+    if (timeout_ > Time()) {
+        Time const expiry = Time::now()+timeout_;
+        if (when == Time() || expiry < when) {
+            when = expiry;
+        }
+    }
+    if (when != Time()) {
+        hub()->timerIs(&timer, when);
+    }
+}
+
+Socket::Deadline::~Deadline() {
+    if (timer_.pending()) {
+        hub()->timerDel(&timer_);
+    }
+}
+
+void Socket::readableIs(bool readable) {
+// Updates the cached read readiness.  If a coroutine is blocked waiting for
+// the socket to become readable, then wake it up.
+    readable_ = readable;
+    if (readable_ && reader_) {
+        Coroutine* const reader = reader_;
+        reader_ = 0;
+        reader->unblock();
+    }
+}
+
+void Socket::writableIs(bool writable) {
+// Updates the cached write readiness.  If a coroutine is blocked waiting for
+// the socket to become writable, then wake it up.
+    writable_ = writable;
+    if (writable_ && writer_) {
+        Coroutine* const writer = writer_;
+        writer_ = 0;
+        writer->unblock();
+    }
+}
+
 void Socket::shutdown(int how) {
     ::shutdown(sd_, how);
 }
@@ -169,8 +297,14 @@ void Socket::close() {
     ::closesocket(sd_);
     sd_ = INVALID_SOCKET;
 #else
+#ifndef CORO_IO_URING
+    if (watched_) {
+        deregister(); // Not left to ::close(), which misses dup'd fds
+    }
+#endif
     ::close(sd_);
     sd_ = -1;
+    watched_ = false;
 #endif
 }
 
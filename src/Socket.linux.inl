@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2013 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+namespace coro {
+
+void Socket::watch() {
+// Registers the socket with the hub's epoll set.  The registration is
+// edge-triggered and lasts until unwatch() or close() removes it, so blocking
+// operations never need to re-arm it.
+    if (watched_) { return; }
+    struct epoll_event ev{0};
+    ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+    ev.data.ptr = this;
+    if (epoll_ctl(hub()->handle(), EPOLL_CTL_ADD, sd_, &ev) < 0) {
+        throw SystemError();
+    }
+    watched_ = true;
+}
+
+void Socket::unwatch() {
+// Removes the socket from the epoll set once an operation has timed out, so
+// that an idle peer costs the poller nothing.  Readiness is unknown until the
+// next watch(), so the next operation tries its syscall first.
+// Best-effort: this runs from a timer callback inside TimerWheel::advance(),
+// where a throw would strand the other due timers and the blocked coroutine.
+    if (!watched_ || reader_ || writer_) { return; }
+    deregister();
+    readable_ = true;
+    writable_ = true;
+}
+
+void Socket::deregister() {
+// Removes the socket from the epoll set, ignoring errors, since neither caller
+// can throw.  close() needs this because epoll drops a registration only when
+// the last descriptor for the file is closed, so a dup'd or inherited fd would
+// otherwise keep delivering events for a freed Socket.
+    epoll_ctl(hub()->handle(), EPOLL_CTL_DEL, sd_, 0);
+    watched_ = false;
+}
+
+void Socket::waitReadable() {
+// Blocks until the hub reports the fd readable.  Throws if the operation's
+// deadline passes first.
+    assert(!reader_ && "another coroutine is already reading");
+    watch();
+    deadlineArm(readTimer_);
+    reader_ = current().get();
+    current()->block();
+    if (readTimedOut_) {
+        throw SocketTimeoutException();
+    }
+}
+
+void Socket::waitWritable() {
+// Blocks until the hub reports the fd writable.  Throws if the operation's
+// deadline passes first.
+    assert(!writer_ && "another coroutine is already writing");
+    watch();
+    deadlineArm(writeTimer_);
+    writer_ = current().get();
+    current()->block();
+    if (writeTimedOut_) {
+        throw SocketTimeoutException();
+    }
+}
+
+void Socket::readTimeout() {
+// Wakes the blocked reader, unless an edge woke it up first.
+    if (Coroutine* const reader = reader_) {
+        readTimedOut_ = true;
+        reader_ = 0;
+        unwatch();
+        reader->unblock();
+    }
+}
+
+void Socket::writeTimeout() {
+// Wakes the blocked writer, unless an edge woke it up first.
+    if (Coroutine* const writer = writer_) {
+        writeTimedOut_ = true;
+        writer_ = 0;
+        unwatch();
+        writer->unblock();
+    }
+}
+
+void Socket::connect(SocketAddr const& addr) {
+// Connect this socket to a remote socket.  The socket was created in
+// non-blocking mode, so the call to connect() below returns immediately.
+    struct sockaddr_in sin = addr.sockaddr();
+    int ret = ::connect(sd_, (struct sockaddr*)&sin, sizeof(sin));
+    if (ret == 0) {
+        return; // Connected immediately (e.g., loopback)
+    } else if (errno != EINPROGRESS) {
+        throw SystemError();
+    }
+
+    Deadline deadline(writeTimer_, writeTimedOut_);
+    writable_ = false;
+    while (!writable_) {
+        waitWritable();
+    }
+
+    // Check for connect error code
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sd_, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        throw SystemError();
+    }
+    if (error) {
+        throw SystemError(error);
+    }
+}
+
+int Socket::acceptRaw() {
+// Accept a new incoming connection asynchronously.  The listen socket is
+// non-blocking, so try accept4() first; if there are no peers waiting in the
+// accept queue, wait for a READ event and try again.
+    Deadline deadline(readTimer_, readTimedOut_);
+    for (;;) {
+        if (readable_) {
+            struct sockaddr_in sin;
+            socklen_t len = sizeof(sin);
+            int const flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+            int sd = accept4(sd_, (struct sockaddr*)&sin, &len, flags);
+            if (sd >= 0) {
+                return sd;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                throw SystemError();
+            }
+            readable_ = false;
+        }
+        // Wait until the socket becomes readable.  At that point, there will
+        // be a peer waiting in the accept queue.
+        waitReadable();
+    }
+}
+
+bool isSocketCloseError(int error) {
+// Return true if the error (as returned by send/recv) is an error that
+// indicates the socket was closed forcibly.  These errors are converted into
+// SocketCloseExceptions.
+    switch (error) {
+    case EPIPE:
+    case ENETRESET:
+    case ECONNABORTED:
+    case ECONNRESET:
+    case ESHUTDOWN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ssize_t Socket::read(char* buf, size_t len, int flags) {
+// Read from the socket asynchronously.  If the socket is known not to be
+// readable, skip the recv() call and block until the hub reports an edge.
+    Deadline deadline(readTimer_, readTimedOut_);
+    for (;;) {
+        if (sd_ == -1) {
+            throw SocketCloseException(); // Closed locally
+        }
+        if (readable_) {
+            ssize_t ret = recv(sd_, buf, len, flags);
+            if (ret >= 0) {
+                return ret; // Recv didn't block
+            } else if (isSocketCloseError(errno)) {
+                throw SocketCloseException(); // Closed remotely
+            } else if (EAGAIN != errno) {
+                throw SystemError();
+            }
+            readable_ = false;
+        }
+        waitReadable();
+    }
+}
+
+ssize_t Socket::write(char const* buf, size_t len, int flags) {
+// Write asynchronously.  MSG_NOSIGNAL takes the place of SO_NOSIGPIPE on
+// Linux: a write to a closed peer returns EPIPE instead of raising SIGPIPE.
+    Deadline deadline(writeTimer_, writeTimedOut_);
+    for (;;) {
+        if (sd_ == -1) {
+            throw SocketCloseException(); // Closed locally
+        }
+        if (writable_) {
+            ssize_t ret = send(sd_, buf, len, flags|MSG_NOSIGNAL);
+            if (ret >= 0) {
+                return ret; // Send didn't block
+            } else if (isSocketCloseError(errno)) {
+                throw SocketCloseException(); // Closed remotely
+            } else if (EAGAIN != errno) {
+                throw SystemError();
+            }
+            writable_ = false;
+        }
+        waitWritable();
+    }
+}
+
+}
@@ -22,30 +22,107 @@
 
 namespace coro {
 
-void Socket::connect(SocketAddr const& addr) {
-// Connect this socket to a remote socket
-    if (fcntl(sd_, F_SETFL, O_NONBLOCK) < 0) {
+void Socket::watch() {
+// Registers read and write filters for the socket with the hub's kqueue.  The
+// filters are edge-triggered (EV_CLEAR) and last until unwatch() or close()
+// removes them, so blocking operations never need to re-arm them.
+    if (watched_) { return; }
+    int const kqfd = hub()->handle();
+    int const flags = EV_ADD|EV_CLEAR;
+    struct kevent ev[2];
+    EV_SET(&ev[0], sd_, EVFILT_READ, flags, 0, 0, this);
+    EV_SET(&ev[1], sd_, EVFILT_WRITE, flags, 0, 0, this);
+    if (kevent(kqfd, ev, 2, 0, 0, 0) < 0) {
         throw SystemError();
     }
+    watched_ = true;
+}
+
+void Socket::unwatch() {
+// Removes the socket's filters from the kqueue once an operation has timed
+// out, so that an idle peer costs the poller nothing.  Readiness is unknown
+// until the next watch(), so the next operation tries its syscall first.
+// Best-effort: this runs from a timer callback inside TimerWheel::advance(),
+// where a throw would strand the other due timers and the blocked coroutine.
+    if (!watched_ || reader_ || writer_) { return; }
+    deregister();
+    readable_ = true;
+    writable_ = true;
+}
+
+void Socket::deregister() {
+// Removes the socket's filters from the kqueue, ignoring errors, since neither
+// caller can throw.  close() needs this because kqueue drops filters only when
+// the last descriptor for the file is closed, so a dup'd or inherited fd would
+// otherwise keep delivering events for a freed Socket.
+    struct kevent ev[2];
+    EV_SET(&ev[0], sd_, EVFILT_READ, EV_DELETE, 0, 0, 0);
+    EV_SET(&ev[1], sd_, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
+    kevent(hub()->handle(), ev, 2, 0, 0, 0);
+    watched_ = false;
+}
+
+void Socket::waitReadable() {
+// Blocks until the hub reports the fd readable.  Throws if the operation's
+// deadline passes first.
+    assert(!reader_ && "another coroutine is already reading");
+    watch();
+    deadlineArm(readTimer_);
+    reader_ = current().get();
+    current()->block();
+    if (readTimedOut_) {
+        throw SocketTimeoutException();
+    }
+}
+
+void Socket::waitWritable() {
+// Blocks until the hub reports the fd writable.  Throws if the operation's
+// deadline passes first.
+    assert(!writer_ && "another coroutine is already writing");
+    watch();
+    deadlineArm(writeTimer_);
+    writer_ = current().get();
+    current()->block();
+    if (writeTimedOut_) {
+        throw SocketTimeoutException();
+    }
+}
+
+void Socket::readTimeout() {
+// Wakes the blocked reader, unless an edge woke it up first.
+    if (Coroutine* const reader = reader_) {
+        readTimedOut_ = true;
+        reader_ = 0;
+        unwatch();
+        reader->unblock();
+    }
+}
+
+void Socket::writeTimeout() {
+// Wakes the blocked writer, unless an edge woke it up first.
+    if (Coroutine* const writer = writer_) {
+        writeTimedOut_ = true;
+        writer_ = 0;
+        unwatch();
+        writer->unblock();
+    }
+}
 
-    // Set the socket in non-blocking mode, so that the call to connect() below
-    // and calls to send/recv do not block.
+void Socket::connect(SocketAddr const& addr) {
+// Connect this socket to a remote socket.  The socket was put in non-blocking
+// mode when it was created, so the call to connect() below returns right away.
     struct sockaddr_in sin = addr.sockaddr();
     int ret = ::connect(sd_, (struct sockaddr*)&sin, sizeof(sin));
     if (ret < 0 && errno != EINPROGRESS) {
         throw SystemError();
     }
 
-    int kqfd = hub()->handle();
-    int flags = EV_ADD|EV_ONESHOT|EV_EOF;
-    struct kevent ev{0};
-    EV_SET(&ev, sd_, EVFILT_WRITE, flags, 0, 0, current().get());
-    if (kevent(kqfd, &ev, 1, 0, 0, 0) < 0) {
-        throw SystemError();
+    Deadline deadline(writeTimer_, writeTimedOut_);
+    writable_ = false;
+    while (!writable_) {
+        waitWritable();
     }
 
-    current()->block();    
-
     // Check for connect error code
     if (::read(sd_, 0, 0) < 0) {
         throw SystemError();
@@ -53,30 +130,30 @@ void Socket::connect(SocketAddr const& addr) {
 }
 
 int Socket::acceptRaw() {
-// Accept a new incoming connection asynchronously. Register to wait for a READ
-// event, which signals that we can call accept() without blocking.
-    int kqfd = hub()->handle();
-    int flags = EV_ADD|EV_ONESHOT;
-    struct kevent ev{0};
-    EV_SET(&ev, sd_, EVFILT_READ, flags, 0, 0, current().get());
-    if (kevent(kqfd, &ev, 1, 0, 0, 0) < 0) {
-        throw SystemError();
-    }
-    // Wait until the socket becomes readable.  At that point, there will be a
-    // peer waiting in the accept queue.
-    current()->block();
-
-    // Accept the peer, and create a new stream socket.
-    struct sockaddr_in sin;
-    socklen_t len = sizeof(sin);
-    int sd = ::accept(sd_, (struct sockaddr*)&sin, &len);
-    if (sd < 0) {
-        throw SystemError();
-    }  
-    if (fcntl(sd, F_SETFL, O_NONBLOCK) < 0) {
-        throw SystemError();
+// Accept a new incoming connection asynchronously.  If the listen socket is
+// not known to be readable, wait for a READ event, which signals that we can
+// call accept() without blocking.
+    Deadline deadline(readTimer_, readTimedOut_);
+    for (;;) {
+        if (readable_) {
+            // Accept the peer, and create a new stream socket.
+            struct sockaddr_in sin;
+            socklen_t len = sizeof(sin);
+            int sd = ::accept(sd_, (struct sockaddr*)&sin, &len);
+            if (sd >= 0) {
+                if (fcntl(sd, F_SETFL, O_NONBLOCK) < 0) {
+                    throw SystemError();
+                }
+                return sd;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                throw SystemError();
+            }
+            readable_ = false;
+        }
+        // Wait until the socket becomes readable.  At that point, there will
+        // be a peer waiting in the accept queue.
+        waitReadable();
     }
-    return sd;
 }
 
 bool isSocketCloseError(int error) {
@@ -96,89 +173,49 @@ bool isSocketCloseError(int error) {
 }
 
 ssize_t Socket::read(char* buf, size_t len, int flags) {
-// Read from the socket asynchronously.
-    if (sd_ == -1) {
-        throw SocketCloseException(); // Closed locally
-    }
-
-    ssize_t ret = recv(sd_, buf, len, flags);
-    if (ret < 0) {
-        if (isSocketCloseError(errno)) {
-            throw SocketCloseException(); // Closed remotely
-        } else if (EAGAIN != errno) {
-            throw SystemError();
+// Read from the socket asynchronously.  If the socket is known not to be
+// readable, skip the recv() call and block until the hub reports an edge.
+    Deadline deadline(readTimer_, readTimedOut_);
+    for (;;) {
+        if (sd_ == -1) {
+            throw SocketCloseException(); // Closed locally
         }
-    } else {
-        return ret; // Recv didn't block
-    } 
-
-    // Recv blocked.  Set up the kevent, and then try to call recv() again
-    int const kqfd = hub()->handle();
-    int const kqflags = EV_ADD|EV_ONESHOT|EV_EOF;
-    struct kevent ev{0};
-    EV_SET(&ev, sd_, EVFILT_READ, kqflags, 0, 0, current().get()); 
-    if (kevent(kqfd, &ev, 1, 0, 0, 0) < 0) {
-        throw SystemError();
-    }
-    current()->block();
-
-    if (sd_ == -1) {
-        throw SocketCloseException();
-    }
-
-    ret = recv(sd_, buf, len, flags);
-    if (ret < 0) {
-        if (isSocketCloseError(errno)) {
-            throw SocketCloseException(); // Closed remotely
-        } else {
-            throw SystemError();
+        if (readable_) {
+            ssize_t ret = recv(sd_, buf, len, flags);
+            if (ret >= 0) {
+                return ret; // Recv didn't block
+            } else if (isSocketCloseError(errno)) {
+                throw SocketCloseException(); // Closed remotely
+            } else if (EAGAIN != errno) {
+                throw SystemError();
+            }
+            readable_ = false;
         }
+        waitReadable();
     }
-    assert(ret >= 0);
-    return ret;
 }
 
 ssize_t Socket::write(char const* buf, size_t len, int flags) {
-// Write asynchronously
-    if (sd_ == -1) {
-        throw SocketCloseException(); // Closed locally
-    }
-
-    ssize_t ret = send(sd_, buf, len, flags);
-    if (ret < 0) {
-        if (isSocketCloseError(errno)) {
-            throw SocketCloseException(); // Closed remotely
-        } else if (EAGAIN != errno) {
-            throw SystemError();
+// Write asynchronously.  If the socket is known not to be writable, skip the
+// send() call and block until the hub reports an edge.
+    Deadline deadline(writeTimer_, writeTimedOut_);
+    for (;;) {
+        if (sd_ == -1) {
+            throw SocketCloseException(); // Closed locally
         }
-    } else {
-        return ret; // Send didn't block
-    } 
-
-    // Send blocked.  Set up the kevent, and then try to call send() again
-    int const kqfd = hub()->handle();
-    int const kqflags = EV_ADD|EV_ONESHOT|EV_EOF;
-    struct kevent ev{0};
-    EV_SET(&ev, sd_, EVFILT_WRITE, kqflags, 0, 0, current().get()); 
-    if (kevent(kqfd, &ev, 1, 0, 0, 0) < 0) {
-        throw SystemError();
-    }
-    current()->block();
-
-    if (sd_ == -1) {
-        throw SocketCloseException();
-    }
-
-    ret = send(sd_, buf, len, flags);
-    if (ret < 0) {
-        if (isSocketCloseError(errno)) {
-            throw SocketCloseException(); // Closed remotely
-        } else {
-            throw SystemError();
+        if (writable_) {
+            ssize_t ret = send(sd_, buf, len, flags);
+            if (ret >= 0) {
+                return ret; // Send didn't block
+            } else if (isSocketCloseError(errno)) {
+                throw SocketCloseException(); // Closed remotely
+            } else if (EAGAIN != errno) {
+                throw SystemError();
+            }
+            writable_ = false;
         }
-    } 
-    assert(ret >= 0);
-    return ret;
+        waitWritable();
+    }
 }
 
 
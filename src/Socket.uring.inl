@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2013 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+namespace coro {
+
+struct io_uring_sqe* ringSqe(uint8_t opcode, int sd, Completion* op) {
+// Queues an SQE for the given operation.  The SQE is submitted by the hub the
+// next time it polls, so the caller must block until the completion arrives.
+// Returns null only on the main coroutine, if the submission queue is full.
+    struct io_uring_sqe* sqe = hub()->sqe();
+    if (!sqe) {
+        return 0;
+    }
+    sqe->opcode = opcode;
+    sqe->fd = sd;
+    sqe->user_data = (uint64_t)op;
+    return sqe;
+}
+
+bool ringCancel(Completion* op) {
+// Asks the kernel to cancel a pending operation.  The operation then
+// completes with -ECANCELED (or with its real result, if it won the race).
+// The cancel request's own CQE has no Completion, and is ignored by the hub.
+// Returns false if there's no room to queue the request yet.
+    struct io_uring_sqe* sqe = ringSqe(IORING_OP_ASYNC_CANCEL, -1, 0);
+    if (!sqe) {
+        return false;
+    }
+    sqe->addr = (uint64_t)op;
+    return true;
+}
+
+bool isCancelError(int error) {
+// Errors that an operation cancelled by ringCancel() can complete with.
+    return error == ECANCELED || error == EINTR;
+}
+
+void Socket::readTimeout() {
+// Cancels the pending read; its completion then wakes the reader.
+    if (readOp_) {
+        readTimedOut_ = true;
+        if (!ringCancel(readOp_)) {
+            hub()->timerIs(&readTimer_, Time()); // No room; retry next time
+        }
+    }
+}
+
+void Socket::writeTimeout() {
+// Cancels the pending write; its completion then wakes the writer.
+    if (writeOp_) {
+        writeTimedOut_ = true;
+        if (!ringCancel(writeOp_)) {
+            hub()->timerIs(&writeTimer_, Time()); // No room; retry next time
+        }
+    }
+}
+
+void Socket::connect(SocketAddr const& addr) {
+// Connect this socket to a remote socket asynchronously.
+    struct sockaddr_in sin = addr.sockaddr();
+    Deadline deadline(writeTimer_, writeTimedOut_);
+    Completion op{current().get(), 0};
+    struct io_uring_sqe* sqe = ringSqe(IORING_OP_CONNECT, sd_, &op);
+    sqe->addr = (uint64_t)&sin;
+    sqe->off = sizeof(sin);
+    writeOp_ = &op;
+    deadlineArm(writeTimer_);
+    current()->block();
+    writeOp_ = 0;
+    if (writeTimedOut_ && isCancelError(-op.result)) {
+        throw SocketTimeoutException();
+    }
+    if (op.result < 0) {
+        throw SystemError(-op.result);
+    }
+}
+
+int Socket::acceptRaw() {
+// Accept a new incoming connection asynchronously.  The CQE for the accept
+// operation carries the new socket descriptor.
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    Deadline deadline(readTimer_, readTimedOut_);
+    Completion op{current().get(), 0};
+    struct io_uring_sqe* sqe = ringSqe(IORING_OP_ACCEPT, sd_, &op);
+    sqe->addr = (uint64_t)&sin;
+    sqe->addr2 = (uint64_t)&len;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    readOp_ = &op;
+    deadlineArm(readTimer_);
+    current()->block();
+    readOp_ = 0;
+    if (readTimedOut_ && isCancelError(-op.result)) {
+        throw SocketTimeoutException();
+    }
+    if (op.result < 0) {
+        throw SystemError(-op.result);
+    }
+    return op.result;
+}
+
+bool isSocketCloseError(int error) {
+// Return true if the error (as returned by send/recv) is an error that
+// indicates the socket was closed forcibly.  These errors are converted into
+// SocketCloseExceptions.
+    switch (error) {
+    case EPIPE:
+    case ENETRESET:
+    case ECONNABORTED:
+    case ECONNRESET:
+    case ESHUTDOWN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ssize_t Socket::read(char* buf, size_t len, int flags) {
+// Read from the socket asynchronously.  Returns the # of bytes read.
+    if (sd_ == -1) {
+        throw SocketCloseException(); // Closed locally
+    }
+
+    Deadline deadline(readTimer_, readTimedOut_);
+    Completion op{current().get(), 0};
+    struct io_uring_sqe* sqe = ringSqe(IORING_OP_RECV, sd_, &op);
+    sqe->addr = (uint64_t)buf;
+    sqe->len = unsigned(len);
+    sqe->msg_flags = flags;
+    readOp_ = &op;
+    deadlineArm(readTimer_);
+    current()->block();
+    readOp_ = 0;
+    if (readTimedOut_ && isCancelError(-op.result)) {
+        throw SocketTimeoutException();
+    }
+    if (op.result < 0) {
+        if (isSocketCloseError(-op.result)) {
+            throw SocketCloseException(); // Closed remotely
+        } else {
+            throw SystemError(-op.result);
+        }
+    }
+    return op.result;
+}
+
+ssize_t Socket::write(char const* buf, size_t len, int flags) {
+// Write to the socket asynchronously.  Returns the # of bytes written.
+    if (sd_ == -1) {
+        throw SocketCloseException(); // Closed locally
+    }
+
+    Deadline deadline(writeTimer_, writeTimedOut_);
+    Completion op{current().get(), 0};
+    struct io_uring_sqe* sqe = ringSqe(IORING_OP_SEND, sd_, &op);
+    sqe->addr = (uint64_t)buf;
+    sqe->len = unsigned(len);
+    sqe->msg_flags = flags|MSG_NOSIGNAL;
+    writeOp_ = &op;
+    deadlineArm(writeTimer_);
+    current()->block();
+    writeOp_ = 0;
+    if (writeTimedOut_ && isCancelError(-op.result)) {
+        throw SocketTimeoutException();
+    }
+    if (op.result < 0) {
+        if (isSocketCloseError(-op.result)) {
+            throw SocketCloseException(); // Closed remotely
+        } else {
+            throw SystemError(-op.result);
+        }
+    }
+    return op.result;
+}
+
+}
@@ -22,6 +22,22 @@
 
 namespace coro {
 
+void Socket::readTimeout() {
+// Cancels the pending read; its completion packet then wakes the reader.
+    if (readOp_) {
+        readTimedOut_ = true;
+        CancelIoEx((HANDLE)sd_, &readOp_->overlapped);
+    }
+}
+
+void Socket::writeTimeout() {
+// Cancels the pending write; its completion packet then wakes the writer.
+    if (writeOp_) {
+        writeTimedOut_ = true;
+        CancelIoEx((HANDLE)sd_, &writeOp_->overlapped);
+    }
+}
+
 void Socket::connect(SocketAddr const& addr) {
 // Windows asynchronous connect
 
@@ -50,6 +66,7 @@ void Socket::connect(SocketAddr const& addr) {
 
     // Initialize the OVERLAPPED structure that contains the user I/O data used
     // to resume the coroutine when ConnectEx completes.
+    Deadline deadline(writeTimer_, writeTimedOut_);
     Overlapped op{0};
     OVERLAPPED* evt = &op.overlapped;
     op.coroutine = current().get();
@@ -62,7 +79,13 @@ void Socket::connect(SocketAddr const& addr) {
             throw SystemError();
         } 
     }
+    writeOp_ = &op;
+    deadlineArm(writeTimer_);
     current()->block();
+    writeOp_ = 0;
+    if (writeTimedOut_ && op.error == ERROR_OPERATION_ABORTED) {
+        throw SocketTimeoutException();
+    }
     if (ERROR_SUCCESS != op.error) {
         throw SystemError(op.error);
     }
@@ -104,6 +127,7 @@ SocketHandle Socket::acceptRaw() {
     
     // Initialize the OVERLAPPED structure that contains the user I/O data used
     // to resume the coroutine when AcceptEx completes. 
+    Deadline deadline(readTimer_, readTimedOut_);
     Overlapped op{0};
     op.coroutine = current().get();
     OVERLAPPED* evt = &op.overlapped;
@@ -118,7 +142,14 @@ SocketHandle Socket::acceptRaw() {
             throw SystemError();
         } 
     }
+    readOp_ = &op;
+    deadlineArm(readTimer_);
     current()->block();
+    readOp_ = 0;
+    if (readTimedOut_ && op.error == ERROR_OPERATION_ABORTED) {
+        ::closesocket(sd);
+        throw SocketTimeoutException();
+    }
     if (ERROR_SUCCESS != op.error) {
         throw SystemError(op.error);
     }
@@ -160,6 +191,7 @@ bool isSocketCloseError(DWORD error) {
 ssize_t Socket::read(char* buf, size_t len, int flags) {
 // Read from the socket asynchronously.  Returns the # of bytes read.
     WSABUF wsabuf = { ULONG(len), buf };
+    Deadline deadline(readTimer_, readTimedOut_);
     Overlapped op{0};
     op.coroutine = current().get();
     OVERLAPPED* evt = &op.overlapped;
@@ -176,7 +208,13 @@ ssize_t Socket::read(char* buf, size_t len, int flags) {
             throw SystemError();
         } 
     }
+    readOp_ = &op;
+    deadlineArm(readTimer_);
     current()->block();
+    readOp_ = 0;
+    if (readTimedOut_ && op.error == ERROR_OPERATION_ABORTED) {
+        throw SocketTimeoutException();
+    }
     if (ERROR_SUCCESS != op.error) {
         if (isSocketCloseError(op.error)) {
             throw SocketCloseException(); // Socket closed remotely during read
@@ -191,6 +229,7 @@ ssize_t Socket::read(char* buf, size_t len, int flags) {
 ssize_t Socket::write(char const* buf, size_t len, int flags) {
 // Write to the socket asynchronously.  Returns the # of bytes written.
     WSABUF wsabuf = { ULONG(len), LPSTR(buf) };
+    Deadline deadline(writeTimer_, writeTimedOut_);
     Overlapped op{0};
     op.coroutine = current().get();
     OVERLAPPED* evt = &op.overlapped;
@@ -206,7 +245,13 @@ ssize_t Socket::write(char const* buf, size_t len, int flags) {
             throw SystemError();
         } 
     }
+    writeOp_ = &op;
+    deadlineArm(writeTimer_);
     current()->block();
+    writeOp_ = 0;
+    if (writeTimedOut_ && op.error == ERROR_OPERATION_ABORTED) {
+        throw SocketTimeoutException();
+    }
     if (ERROR_SUCCESS != op.error) {
         if (isSocketCloseError(op.error)) {
             throw SocketCloseException(); // Socket closed remotely during write
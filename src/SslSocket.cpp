@@ -60,7 +60,18 @@ SslSocket::~SslSocket() {
 }
 
 Ptr<Socket> SslSocket::accept() {
-    return Ptr<Socket>(new SslSocket(acceptRaw(), context_));
+// The new SslSocket owns the accepted handle, unless its constructor throws.
+    SocketHandle const sd = acceptRaw();
+    try {
+        return Ptr<Socket>(new SslSocket(sd, context_));
+    } catch (...) {
+#ifdef _WIN32
+        ::closesocket(sd);
+#else
+        ::close(sd);
+#endif
+        throw;
+    }
 }
 
 void SslSocket::listen(int backlog) {
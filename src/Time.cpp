@@ -26,16 +26,23 @@
 namespace coro {
 
 Time Time::now() {
+// Returns the current time from a monotonic clock, so that NTP adjustments
+// and manual clock changes can't reorder timers or break sleeps.
 #ifdef _WIN32
+    static LARGE_INTEGER freq{0};
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
     LARGE_INTEGER count{0};
     QueryPerformanceCounter(&count);
-    LARGE_INTEGER freq{0};
-    QueryPerformanceFrequency(&freq);
-    return Time::microsec(1000000 * count.QuadPart / freq.QuadPart);
+    // Split the conversion, so that count*1000000000 can't overflow.
+    int64_t const sec = count.QuadPart/freq.QuadPart;
+    int64_t const rem = count.QuadPart%freq.QuadPart;
+    return Time::nanosec(sec*1000000000+rem*1000000000/freq.QuadPart);
 #else
-    struct timeval ts{0};
-    gettimeofday(&ts, 0);
-    return Time::sec(ts.tv_sec)+Time::microsec(ts.tv_usec); 
+    struct timespec ts{0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return Time::nanosec(int64_t(ts.tv_sec)*1000000000+ts.tv_nsec);
 #endif
 }
 
@@ -43,8 +50,8 @@ Time Time::now() {
 struct timespec Time::timespec() const {
 // Convert to a timespec struct for use with various system calls
     struct timespec out{0};
-    out.tv_sec = microsec_/1000000;
-    out.tv_nsec = (microsec_%1000000)*1000;
+    out.tv_sec = nanosec_/1000000000;
+    out.tv_nsec = nanosec_%1000000000;
     return out;
 }
 #endif
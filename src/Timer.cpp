@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "coro/Common.hpp"
+#include "coro/Timer.hpp"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace coro {
+
+static inline int fls64(uint64_t bits) {
+// Returns the index of the highest set bit; 'bits' must be non-zero.
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, bits);
+    return int(index);
+#else
+    return 63-__builtin_clzll(bits);
+#endif
+}
+
+static inline int ffs64(uint64_t bits) {
+// Returns the index of the lowest set bit; 'bits' must be non-zero.
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return int(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+static inline uint64_t rotl64(uint64_t bits, int n) {
+    n &= 63;
+    return n ? (bits << n)|(bits >> (64-n)) : bits;
+}
+
+static inline uint64_t rotr64(uint64_t bits, int n) {
+    n &= 63;
+    return n ? (bits >> n)|(bits << (64-n)) : bits;
+}
+
+static inline uint64_t ticks(Time const& time) {
+// Converts a time to whole ticks, rounding down (for the current time).
+    return uint64_t(std::max(int64_t(0), time.microsec()));
+}
+
+static inline uint64_t expiryTicks(Time const& time) {
+// Converts an expiry time to ticks, rounding up, so timers never fire early.
+    return uint64_t(std::max(int64_t(0), (time.nanosec()+999)/1000));
+}
+
+Timer::Timer(std::function<void()> const& func) :
+    func_(func),
+    next_(0),
+    prev_(0),
+    slot_(0),
+    wheel_(0) {
+}
+
+Timer::~Timer() {
+    if (wheel_) {
+        wheel_->timerDel(this);
+    }
+}
+
+TimerWheel::TimerWheel() : expired_(0), now_(0), size_(0) {
+    memset(slot_, 0, sizeof(slot_));
+    memset(pending_, 0, sizeof(pending_));
+}
+
+TimerWheel::~TimerWheel() {
+// Detaches the timers that are still scheduled, so that they don't point at
+// the wheel after it's gone.
+    for (int level = 0; level < LEVELS; ++level) {
+        for (int slot = 0; slot < SLOTS; ++slot) {
+            while (Timer* timer = slot_[level][slot]) {
+                unlink(timer);
+                timer->wheel_ = 0;
+            }
+        }
+    }
+    while (Timer* timer = expired_) {
+        unlink(timer);
+        timer->wheel_ = 0;
+    }
+}
+
+void TimerWheel::link(Timer** slot, Timer* timer) {
+    timer->slot_ = slot;
+    timer->prev_ = 0;
+    timer->next_ = *slot;
+    if (*slot) {
+        (*slot)->prev_ = timer;
+    }
+    *slot = timer;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+    if (timer->prev_) {
+        timer->prev_->next_ = timer->next_;
+    } else {
+        *timer->slot_ = timer->next_;
+    }
+    if (timer->next_) {
+        timer->next_->prev_ = timer->prev_;
+    }
+    Timer** slot = timer->slot_;
+    timer->next_ = 0;
+    timer->prev_ = 0;
+    timer->slot_ = 0;
+    // Clear the slot's bit in the bitmap if the slot is now empty.
+    Timer** const first = &slot_[0][0];
+    if (!*slot && slot >= first && slot < first+LEVELS*SLOTS) {
+        size_t const index = size_t(slot-first);
+        pending_[index/SLOTS] &= ~(uint64_t(1) << (index%SLOTS));
+    }
+}
+
+void TimerWheel::insert(Timer* timer) {
+// Puts the timer into the slot for its expiry, relative to the wheel's
+// current time.  Expiries beyond the wheel's range go into the last slot the
+// top level can reach, and are re-inserted from there.
+    uint64_t const expiry = expiryTicks(timer->time_);
+    if (expiry <= now_) {
+        link(&expired_, timer);
+        return;
+    }
+    uint64_t const range = (uint64_t(1) << (LEVELS*BITS))-1;
+    uint64_t place = std::min(expiry, now_|range);
+    if (place <= now_) {
+        place = now_+1; // now_ is at the very end of the range; cascade
+    }
+    // If now_ is at the very end of the range, then place carries past the
+    // top level; its next slot comes right after now_ all the same.
+    int const level = std::min(fls64(place^now_)/BITS, int(LEVELS-1));
+    int const slot = int(place >> (level*BITS)) & (SLOTS-1);
+    link(&slot_[level][slot], timer);
+    pending_[level] |= uint64_t(1) << slot;
+}
+
+void TimerWheel::timerIs(Timer* timer, Time const& time) {
+// Schedules 'timer' to run at 'time'.  If the timer is already scheduled, it
+// is moved.  A time in the past runs the timer on the next advance().
+    if (timer->wheel_) {
+        timerDel(timer);
+    }
+    timer->time_ = time;
+    timer->wheel_ = this;
+    size_++;
+    insert(timer);
+}
+
+void TimerWheel::timerDel(Timer* timer) {
+    if (!timer->wheel_) { return; }
+    assert(timer->wheel_ == this);
+    unlink(timer);
+    timer->wheel_ = 0;
+    size_--;
+}
+
+void TimerWheel::advance(Time const& now) {
+// Moves the wheel forward to 'now', and runs the callbacks of all the timers
+// that have expired.  Each level that changes digit has its passed slots
+// emptied in one go; timers in those slots that aren't due yet cascade down
+// to a finer level.  Callbacks may schedule or cancel other timers.
+    Timer* due = 0; // Timers taken from passed slots
+    while (Timer* timer = expired_) {
+        unlink(timer);
+        link(&due, timer);
+    }
+    uint64_t const to = ticks(now);
+    if (to > now_) {
+        for (int level = 0; level < LEVELS; ++level) {
+            uint64_t const from = now_ >> (level*BITS);
+            uint64_t const until = to >> (level*BITS);
+            if (from == until) {
+                break; // Coarser levels haven't changed either
+            }
+            // Slots from+1 through until (mod 64) have been passed.
+            uint64_t const count = until-from;
+            uint64_t const mask = (count >= SLOTS) ? ~uint64_t(0) :
+                rotl64((uint64_t(1) << count)-1, int(from+1));
+            uint64_t passed = pending_[level] & mask;
+            while (passed) {
+                int const slot = ffs64(passed);
+                passed &= passed-1;
+                while (Timer* timer = slot_[level][slot]) {
+                    unlink(timer);
+                    link(&due, timer);
+                }
+            }
+        }
+        now_ = to;
+    }
+    while (Timer* timer = due) {
+        unlink(timer);
+        if (expiryTicks(timer->time_) <= now_) {
+            timer->wheel_ = 0;
+            size_--;
+            timer->func_();
+        } else {
+            insert(timer);
+        }
+    }
+}
+
+Time TimerWheel::next() const {
+// Returns the earliest time at which advance() has work to do: either a
+// timer expires, or a slot full of timers has to cascade.  The result is a
+// lower bound on the next expiry, so waiting until then never fires a timer
+// late.  Returns the wheel's current time if there's nothing to wait for.
+    if (expired_ || !size_) {
+        return Time::microsec(int64_t(now_));
+    }
+    uint64_t next = ~uint64_t(0);
+    for (int level = 0; level < LEVELS; ++level) {
+        if (!pending_[level]) { continue; }
+        // Slots at each level only hold timers with a digit greater than the
+        // current one, so count the slots to the next non-empty one.
+        uint64_t const digit = now_ >> (level*BITS);
+        int const ahead = ffs64(rotr64(pending_[level], int(digit+1)))+1;
+        next = std::min(next, (digit+ahead) << (level*BITS));
+    }
+    return Time::microsec(int64_t(next));
+}
+
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2013 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "coro/Common.hpp"
+#include "coro/Watchdog.hpp"
+#include "coro/Hub.hpp"
+
+namespace coro {
+
+void stallPrint(Stall const& stall) {
+    if (stall.coroutine) {
+        fprintf(stderr, "coro: hub %p stalled for %.3f s in coroutine %p\n",
+            (void*)stall.hub, stall.duration.sec(), (void*)stall.coroutine);
+    } else {
+        fprintf(stderr, "coro: hub %p stalled for %.3f s outside coroutines\n",
+            (void*)stall.hub, stall.duration.sec());
+    }
+    for (auto const& frame : stall.backtrace) {
+        fprintf(stderr, "    %s\n", frame.c_str());
+    }
+    fflush(stderr);
+}
+
+#ifdef __linux__
+struct Trace {
+// The one backtrace request in flight.  A request may be abandoned while its
+// signal is still pending (e.g., if the hub's thread has it blocked), and the
+// signal can arrive much later, after the watchdog that sent it is gone.  So
+// the result goes to this static slot rather than the watchdog, and the
+// handler only fills it in if the signal's sequence # is still the current
+// request's.  The handler claims the request by negating 'seq', so that the
+// requester can't abandon it while the handler is writing.
+    enum { FRAMES = 64 };
+    std::atomic<int> seq; // Current request; -seq once claimed; 0 if none
+    std::atomic<int> done; // Last request whose frames are filled in
+    void* frame[FRAMES];
+    int frames;
+};
+
+static Trace trace;
+static std::mutex traceMutex; // One request at a time
+static struct sigaction sigtrace; // Handler installed before traceHandler()
+
+void Watchdog::traceHandler(int signo, siginfo_t* info, void* context) {
+// Runs on the hub's thread, on the stack of whatever it's stuck in.
+    int seq = info->si_value.sival_int;
+    if (info->si_code != SI_QUEUE || seq <= 0) {
+        if (sigtrace.sa_flags & SA_SIGINFO) {
+            sigtrace.sa_sigaction(signo, info, context); // Not ours; chain
+        } else if (sigtrace.sa_handler != SIG_DFL &&
+                   sigtrace.sa_handler != SIG_IGN) {
+            sigtrace.sa_handler(signo);
+        }
+        return;
+    }
+    if (!trace.seq.compare_exchange_strong(seq, -seq)) {
+        return; // Stale request; the watchdog gave up on it
+    }
+    trace.frames = ::backtrace(trace.frame, Trace::FRAMES);
+    trace.done.store(seq, std::memory_order_release);
+}
+
+static void registerTraceHandler(void (*handler)(int, siginfo_t*, void*)) {
+    // Installed once, when the first watchdog is created.  A handler the
+    // application installed earlier still gets the signals that don't come
+    // from a watchdog.  backtrace() loads libgcc on first use, which isn't
+    // safe to do in a signal handler, so do it here.
+    void* frame = 0;
+    ::backtrace(&frame, 1);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = handler;
+    sa.sa_flags = SA_SIGINFO|SA_RESTART;
+    if (sigaction(CORO_WATCHDOG_SIGNAL, &sa, &sigtrace) < 0) {
+        abort();
+    }
+}
+#endif
+
+Watchdog::Watchdog(Hub* hub, Time const& threshold, StallHandler const& handler) :
+    hub_(hub),
+    threshold_(threshold),
+    handler_(handler),
+    done_(false) {
+// Starts watching 'hub'.  Must be called from the hub's thread.
+    assert(threshold > Time());
+#ifdef __linux__
+    static std::once_flag trace;
+    std::call_once(trace, registerTraceHandler, &Watchdog::traceHandler);
+    hubThread_ = pthread_self();
+#endif
+    thread_ = std::thread([this] { run(); });
+}
+
+Watchdog::~Watchdog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void Watchdog::run() {
+// Samples the hub's progress counter a few times per threshold.  Time spent
+// blocked in poll() is idle time, not a stall.
+    auto const interval = std::chrono::nanoseconds(threshold_.nanosec()/4);
+    uint64_t last = hub_->beat_.load(std::memory_order_relaxed);
+    Time since = Time::now();
+    bool reported = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!done_) {
+        cond_.wait_for(lock, interval);
+        if (done_) {
+            break;
+        }
+        uint64_t const beat = hub_->beat_.load(std::memory_order_relaxed);
+        Time const now = Time::now();
+        if (beat != last || hub_->polling_.load(std::memory_order_relaxed) ||
+            !hub_->running_.load(std::memory_order_relaxed)) {
+            last = beat;
+            since = now;
+            reported = false;
+        } else if (!reported && now-since >= threshold_) {
+            Stall stall;
+            stall.hub = hub_;
+            stall.coroutine = hub_->active_.load(std::memory_order_relaxed);
+            stall.duration = now-since;
+            lock.unlock();
+            backtrace(stall);
+            handler_(stall);
+            lock.lock();
+            reported = true;
+        }
+    }
+}
+
+void Watchdog::backtrace(Stall& stall) {
+// Asks the hub's thread for a backtrace, and symbolizes it here, where it's
+// safe to allocate.  Gives up if the thread doesn't answer promptly (e.g., if
+// it has the signal blocked).
+#ifdef __linux__
+    static int next = 0;
+    std::lock_guard<std::mutex> lock(traceMutex);
+    int const seq = next = next%1000000000+1; // Never 0 or negative
+    trace.seq.store(seq);
+    union sigval value;
+    value.sival_int = seq;
+    if (pthread_sigqueue(hubThread_, CORO_WATCHDOG_SIGNAL, value) != 0) {
+        trace.seq.store(0);
+        return;
+    }
+    Time const start = Time::now();
+    while (trace.done.load(std::memory_order_acquire) != seq) {
+        int expected = seq;
+        if (Time::now()-start > Time::millisec(100) &&
+            trace.seq.compare_exchange_strong(expected, 0)) {
+            return; // Abandoned; a late signal won't match any more
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    trace.seq.store(0);
+    int const frames = trace.frames;
+    char** symbols = backtrace_symbols(trace.frame, frames);
+    if (!symbols) {
+        return;
+    }
+    for (int i = 0; i < frames; ++i) {
+        stall.backtrace.push_back(symbols[i]);
+    }
+    free(symbols);
+#endif
+}
+
+}
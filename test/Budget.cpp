@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+#include <thread>
+
+using coro::Time;
+
+static void spin(Time const& time) {
+    Time const start = Time::now();
+    while (Time::now()-start < time) {}
+}
+
+void testCount() {
+// A pass runs at most the budgeted # of coroutines; the rest keep their place.
+    auto const hub = coro::hub();
+    hub->quiesceBudgetIs(3, Time());
+    std::vector<int> order;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 0; i < 10; ++i) {
+        coros.push_back(coro::start([&order, i] { order.push_back(i); }));
+    }
+    hub->quiesce();
+    assert(order.size() == 3);
+    hub->quiesce();
+    assert(order.size() == 6);
+    coro::run();
+    for (int i = 0; i < 10; ++i) {
+        assert(order[i] == i);
+    }
+    hub->quiesceBudgetIs(0, Time());
+}
+
+void testTime() {
+// A pass stops once it has used up its time budget.
+    auto const hub = coro::hub();
+    hub->quiesceBudgetIs(0, Time::millisec(2));
+    int count = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 0; i < 10; ++i) {
+        coros.push_back(coro::start([&] {
+            spin(Time::millisec(1));
+            count++;
+        }));
+    }
+    hub->quiesce();
+    assert(count >= 1 && count <= 2);
+    coro::run();
+    assert(count == 10);
+    hub->quiesceBudgetIs(0, Time());
+}
+
+void testAccounting() {
+// Run time accumulates across yields; burst time resets when a coroutine
+// waits.
+    auto const hub = coro::hub();
+    hub->quiesceBudgetIs(0, Time::millisec(100));
+    coro::Event event;
+    coro::Ptr<coro::Coroutine> coro;
+    coro = coro::start([&] {
+        spin(Time::millisec(1));
+        coro::yield();
+        spin(Time::millisec(1));
+        coro::yield();
+        assert(coro->burstTime() >= Time::millisec(2));
+        event.wait();
+        assert(coro->burstTime() == Time());
+    });
+    auto notifier = coro::start([&] {
+        while (coro->status() != coro::Coroutine::WAITING) {
+            coro::yield();
+        }
+        event.notifyAll();
+    });
+    coro::run();
+    assert(coro->runTime() >= Time::millisec(2));
+    assert(coro->burstTime() < Time::millisec(1));
+    hub->quiesceBudgetIs(0, Time());
+}
+
+void testPoll() {
+// Compute-bound coroutines that keep yielding under a time budget don't hold
+// off I/O: each pass stops when the budget runs out, and run() checks for
+// ready I/O before the next one.  Without the budget, one pass over the
+// spinners takes about 50 ms, and a read that becomes ready during it isn't
+// seen until the pass ends.  The reader is critical, so it runs as soon as
+// a poll has woken it.
+    auto const hub = coro::hub();
+    hub->quiesceBudgetIs(0, Time::millisec(2));
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9500));
+    ls->listen(1);
+    bool done = false;
+    std::atomic<int64_t> written(0);
+    Time latency;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    coros.push_back(coro::start([&] {
+        auto sd = ls->accept();
+        char buf[1];
+        sd->readAll(buf, sizeof(buf));
+        latency = Time::now()-Time::microsec(written.load());
+        done = true;
+    }));
+    coros.back()->priorityIs(coro::Coroutine::CRITICAL); // Runs once woken
+    for (int i = 0; i < 50; ++i) {
+        coros.push_back(coro::start([&] {
+            while (!done) {
+                spin(Time::millisec(1));
+                coro::yield();
+            }
+        }));
+    }
+    std::thread writer([&] {
+        int const sd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in sin = coro::SocketAddr("127.0.0.1", 9500).sockaddr();
+        int const ret = connect(sd, (struct sockaddr*)&sin, sizeof(sin));
+        assert(ret == 0);
+        usleep(20000); // Let the spinners get going
+        written = Time::now().microsec();
+        ssize_t const len = write(sd, "x", 1);
+        assert(len == 1);
+        usleep(100000);
+        close(sd);
+    });
+    coro::run();
+    writer.join();
+    assert(latency < Time::millisec(20));
+    hub->quiesceBudgetIs(0, Time());
+}
+
+int main() {
+    testCount();
+    testTime();
+    testAccounting();
+    testPoll();
+    return 0;
+}
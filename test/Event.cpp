@@ -2,7 +2,7 @@
 #include <coro/Common.hpp>
 #include <coro/coro.hpp>
 
-int main() {
+void testNotify() {
     auto event = coro::Event();
     auto trigger = false;
 
@@ -19,6 +19,113 @@ int main() {
     });
 
     coro::run();
+}
+
+void testWaitFor() {
+// A timed wait reports whether it was notified, and leaves no timer or wait
+// record behind either way.
+    coro::Event event;
+    bool notified = false;
+    bool timedOut = true;
+    auto waiter = coro::start([&]() {
+        timedOut = !event.waitFor(coro::Time::millisec(10));
+        notified = event.waitFor(coro::Time::sec(60));
+    });
+    auto notifier = coro::start([&]() {
+        coro::sleep(coro::Time::millisec(50));
+        event.notifyAll();
+    });
+    auto const start = coro::Time::now();
+    coro::run();
+    assert(timedOut);
+    assert(notified);
+    assert(coro::Time::now()-start < coro::Time::sec(5)); // Timer cancelled
+}
+
+void testWaitForCond() {
+// Lots of coroutines time out waiting on an event that's never notified.
+    coro::Event event;
+    int timeouts = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> waiters;
+    for (int i = 0; i < 1000; ++i) {
+        waiters.push_back(coro::start([&]() {
+            if (!event.waitFor(coro::Time::millisec(5), [] { return false; })) {
+                timeouts++;
+            }
+        }));
+    }
+    coro::run();
+    assert(timeouts == 1000);
+    event.notifyAll(); // No stale records left to notify
+}
+
+void testInterruptibleSleep() {
+// waitFor() doubles as a sleep that another coroutine can cut short.
+    coro::Event wakeup;
+    bool interrupted = false;
+    auto sleeper = coro::start([&]() {
+        interrupted = wakeup.waitFor(coro::Time::sec(60));
+    });
+    auto waker = coro::start([&]() {
+        wakeup.notifyAll();
+    });
+    auto const start = coro::Time::now();
+    coro::run();
+    assert(interrupted);
+    assert(coro::Time::now()-start < coro::Time::sec(5));
+}
+
+bool pingPong(int rounds) {
+// Two coroutines take turns; returns true if they finished in one quiesce().
+    coro::Event ping;
+    coro::Event pong;
+    bool done = false;
+    int count = 0;
+    auto b = coro::start([&] {
+        for (;;) {
+            pong.wait();
+            if (done) { break; }
+            assert(count%2 == 1);
+            count++;
+            ping.notifyAll();
+        }
+    });
+    auto a = coro::start([&] {
+        for (int i = 0; i < rounds; ++i) {
+            assert(count%2 == 0);
+            count++;
+            pong.notifyAll();
+            ping.wait();
+        }
+        done = true;
+        pong.notifyAll();
+    });
+    coro::hub()->quiesce();
+    bool const quick = a->status() == coro::Coroutine::EXITED &&
+        b->status() == coro::Coroutine::EXITED;
+    coro::run();
+    assert(count == 2*rounds);
+    return quick;
+}
 
+void testHandoff() {
+// A coroutine woken by the running one runs as soon as the waker waits, but
+// the handoffs are bounded, so the pair can't monopolize the hub.
+    auto const hub = coro::hub();
+    assert(hub->handoffMax() == 16);
+    assert(!pingPong(1000));
+    hub->handoffMaxIs(SIZE_MAX);
+    assert(pingPong(1000));
+    hub->handoffMaxIs(0);
+    assert(!pingPong(1000));
+    hub->handoffMaxIs(16);
+}
+
+int main() {
+    testNotify();
+    testHandoff();
+    testWaitFor();
+    testWaitForCond();
+    testInterruptibleSleep();
     return 0;
 }
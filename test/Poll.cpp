@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+using coro::Time;
+
+static int echo(unsigned short port, int clients) {
+// Echoes one message per client over loopback; returns the # echoed.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", port));
+    ls->listen(64);
+    int echoed = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    coros.push_back(coro::start([&] {
+        for (int i = 0; i < clients; ++i) {
+            coro::Ptr<coro::Socket> sd = ls->accept();
+            coros.push_back(coro::start([sd] {
+                char buf[64];
+                ssize_t len = 0;
+                while ((len = sd->read(buf, sizeof(buf))) > 0) {
+                    sd->writeAll(buf, len);
+                }
+            }));
+        }
+    }));
+    for (int i = 0; i < clients; ++i) {
+        coros.push_back(coro::start([&, port] {
+            auto sd = std::make_shared<coro::Socket>();
+            sd->connect(coro::SocketAddr("127.0.0.1", port));
+            char const msg[] = "hello";
+            sd->writeAll(msg, sizeof(msg));
+            char buf[sizeof(msg)];
+            sd->readAll(buf, sizeof(buf));
+            assert(!memcmp(buf, msg, sizeof(msg)));
+            echoed++;
+            sd->shutdown(SHUT_WR);
+        }));
+    }
+    coro::run();
+    return echoed;
+}
+
+void testBusyPoll() {
+// Busy polling picks up I/O while spinning, rather than in a blocking wait,
+// and doesn't change what gets delivered.  SO_BUSY_POLL is best-effort, so
+// socket creation works even if the process isn't allowed to set it.
+    auto const hub = coro::hub();
+    uint64_t const hits = hub->busyPollHits();
+    assert(echo(9402, 5) == 5);
+    assert(hub->busyPollHits() == hits); // Off by default
+
+    hub->busyPollIs(Time::millisec(1), 50);
+    assert(hub->busyPoll() == Time::millisec(1));
+    assert(hub->socketBusyPoll() == 50);
+    assert(echo(9404, 5) == 5);
+    assert(hub->busyPollHits() > hits);
+    hub->busyPollIs(Time());
+    assert(hub->busyPoll() == Time());
+}
+
+int main() {
+    testBusyPoll();
+    return 0;
+}
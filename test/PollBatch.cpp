@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+static std::vector<int> wakeups(unsigned short port, int conns) {
+// Blocks a reader on each of 'conns' connections, then makes them all
+// readable at once.  Returns the quiesce() pass in which each reader woke up;
+// readers woken by the same poll() run in the same pass.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", port));
+    ls->listen(64);
+
+    std::vector<coro::Ptr<coro::Socket>> clients;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    std::vector<int> woke;
+    int pass = 0;
+    coros.push_back(coro::start([&] {
+        for (int i = 0; i < conns; ++i) {
+            coro::Ptr<coro::Socket> sd = ls->accept();
+            coros.push_back(coro::start([&, sd] {
+                char buf[16];
+                sd->read(buf, sizeof(buf));
+                woke.push_back(pass);
+            }));
+        }
+    }));
+    coros.push_back(coro::start([&] {
+        for (int i = 0; i < conns; ++i) {
+            auto sd = std::make_shared<coro::Socket>();
+            sd->connect(coro::SocketAddr("127.0.0.1", port));
+            clients.push_back(sd);
+        }
+        coro::sleep(coro::Time::millisec(10)); // Readers are all blocked
+        for (auto sd : clients) {
+            // Not Socket::write(), which may wait for a poll() (io_uring)
+            send(sd->fileno(), "ping", 4, MSG_NOSIGNAL);
+        }
+        while (woke.size() < size_t(conns)) {
+            pass++;
+            coro::yield();
+        }
+    }));
+    coro::run();
+    return woke;
+}
+
+void testBatch() {
+// One poll() wakes all the ready readers, unless the batch is smaller.
+    auto const hub = coro::hub();
+    size_t const batch = hub->pollBatch();
+    std::vector<int> woke = wakeups(9400, 8);
+    assert(woke.size() == 8);
+    for (auto pass : woke) {
+        assert(pass == woke.front());
+    }
+
+    hub->pollBatchIs(1);
+    assert(hub->pollBatch() == 1);
+    woke = wakeups(9400, 8);
+    assert(woke.size() == 8);
+    for (size_t i = 1; i < woke.size(); ++i) {
+        assert(woke[i] > woke[i-1]);
+    }
+    hub->pollBatchIs(batch);
+}
+
+int main() {
+    testBatch();
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+using coro::Time;
+
+void testSkip() {
+// Empty non-blocking polls are skipped while coroutines keep yielding, and
+// I/O still gets through once it's ready.
+    auto const hub = coro::hub();
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9401));
+    ls->listen(64);
+    uint64_t const skipped = hub->pollsSkipped();
+    bool accepted = false;
+    auto acceptor = coro::start([&] {
+        ls->accept(); // Blocked, so run() has I/O to check for
+        accepted = true;
+    });
+    auto busy = coro::start([&] {
+        for (int i = 0; i < 1000; ++i) {
+            coro::yield();
+        }
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", 9401));
+    });
+    coro::run();
+    assert(accepted);
+    assert(hub->pollsSkipped() > skipped);
+}
+
+void testWakeup() {
+// Wakeups from post() aren't I/O, so they don't stop polls from being
+// skipped.
+    auto const hub = coro::hub();
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9405));
+    ls->listen(64);
+    uint64_t const skipped = hub->pollsSkipped();
+    int posted = 0;
+    auto acceptor = coro::start([&] {
+        ls->accept(); // Blocked, so run() has I/O to check for
+    });
+    auto busy = coro::start([&] {
+        for (int i = 0; i < 1000; ++i) {
+            hub->post([&] { posted++; }); // Signals the hub every time
+            coro::yield();
+        }
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", 9405));
+    });
+    coro::run();
+    assert(posted == 1000);
+    assert(hub->pollsSkipped()-skipped > 100);
+}
+
+void testLatencyMax() {
+// However many iterations run() may skip, I/O is checked at least once per
+// latency cap.
+    auto const hub = coro::hub();
+    hub->pollSkipMaxIs(1 << 20, Time::millisec(2));
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9403));
+    ls->listen(64);
+    Time sent;
+    Time latency;
+    bool done = false;
+    auto reader = coro::start([&] {
+        auto sd = ls->accept();
+        char buf[16];
+        sd->read(buf, sizeof(buf)); // Blocked, so run() has I/O to check for
+        latency = Time::now()-sent;
+        done = true;
+    });
+    auto writer = coro::start([&] {
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", 9403));
+        coro::sleep(Time::millisec(50)); // Long enough to skip ~1M polls
+        sent = Time::now();
+        send(sd->fileno(), "ping", 4, MSG_NOSIGNAL); // Doesn't wait for poll()
+        while (!done) {
+            coro::sleep(Time::millisec(1));
+        }
+    });
+    auto busy = coro::start([&] {
+        while (!done) {
+            Time const start = Time::now();
+            while (Time::now()-start < Time::microsec(10)) {}
+            coro::yield();
+        }
+    });
+    coro::run();
+    assert(latency < Time::millisec(20));
+    hub->pollSkipMaxIs(8, Time::microsec(250));
+}
+
+int main() {
+    testSkip();
+    testWakeup();
+    testLatencyMax();
+    return 0;
+}
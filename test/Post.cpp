@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+#include <thread>
+#include <atomic>
+
+void testPostOrder() {
+// Closures posted from another thread run on the hub's thread, in order.
+    auto const hub = coro::hub();
+    auto const id = std::this_thread::get_id();
+    std::vector<int> order;
+    coro::Event done;
+    auto waiter = coro::start([&] {
+        done.wait([&] { return order.size() == 1000; });
+    });
+    std::thread producer([&] {
+        for (int i = 0; i < 1000; ++i) {
+            hub->post([&, i] {
+                assert(std::this_thread::get_id() == id);
+                order.push_back(i);
+                done.notifyAll();
+            });
+        }
+    });
+    coro::run(); // Only a waiter is left, so the hub blocks until woken
+    producer.join();
+    assert(waiter->status() == coro::Coroutine::EXITED);
+    for (int i = 0; i < 1000; ++i) {
+        assert(order[i] == i);
+    }
+}
+
+void testPostWakeup() {
+// A hub blocked in poll() with no timers wakes up when a result is posted.
+    auto const hub = coro::hub();
+    int result = 0;
+    coro::Event ready;
+    auto waiter = coro::start([&] {
+        ready.wait([&] { return result != 0; });
+    });
+    std::thread pool([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        hub->post([&] {
+            result = 42;
+            ready.notifyAll();
+        });
+    });
+    coro::run();
+    pool.join();
+    assert(result == 42);
+    assert(waiter->status() == coro::Coroutine::EXITED);
+}
+
+void testPostStart() {
+// A posted closure can start coroutines on the hub.
+    auto const hub = coro::hub();
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    int count = 0;
+    coro::Event done;
+    auto waiter = coro::start([&] {
+        done.wait([&] { return count == 10; });
+    });
+    std::thread other([&] {
+        for (int i = 0; i < 10; ++i) {
+            hub->post([&] {
+                coros.push_back(coro::start([&] {
+                    coro::yield();
+                    count++;
+                    done.notifyAll();
+                }));
+            });
+        }
+    });
+    coro::run();
+    other.join();
+    assert(count == 10);
+    assert(coros.size() == 10);
+}
+
+int main() {
+    testPostOrder();
+    testPostWakeup();
+    testPostStart();
+    return 0;
+}
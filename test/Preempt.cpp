@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+using coro::Time;
+
+void testOff() {
+// Without preemption, checkpoint() never yields.
+    int count = 0;
+    auto spinner = coro::start([&] {
+        Time const start = Time::now();
+        while (Time::now()-start < Time::millisec(20)) {
+            coro::checkpoint();
+        }
+        assert(count == 0);
+    });
+    auto other = coro::start([&] { count++; });
+    coro::run();
+    assert(count == 1);
+}
+
+#ifdef __linux__
+void testPreempt() {
+// A coroutine that loops past its slice yields at a checkpoint, so the other
+// coroutines keep running.
+    auto const hub = coro::hub();
+    hub->preemptIs(Time::millisec(1));
+    int count = 0;
+    bool done = false;
+    auto spinner = coro::start([&] {
+        Time const start = Time::now();
+        while (count < 3) {
+            coro::checkpoint();
+            assert(Time::now()-start < Time::sec(5));
+        }
+        done = true;
+    });
+    auto other = coro::start([&] {
+        while (!done) {
+            count++;
+            coro::yield();
+        }
+    });
+    coro::run();
+    assert(count >= 3);
+    hub->preemptIs(Time());
+}
+
+void testMain() {
+// checkpoint() on the main coroutine just starts a new slice.
+    auto const hub = coro::hub();
+    hub->preemptIs(Time::millisec(1));
+    Time const start = Time::now();
+    while (Time::now()-start < Time::millisec(10)) {
+        coro::checkpoint();
+    }
+    hub->preemptIs(Time());
+}
+
+void testHandoff() {
+// A coroutine switched to directly by one that ran past its slice starts a
+// fresh slice, rather than yielding at its first checkpoint.
+    auto const hub = coro::hub();
+    hub->preemptIs(Time::millisec(1));
+    coro::Event event;
+    bool fresh = false;
+    auto waiter = coro::start([&] {
+        event.wait();
+        fresh = (coroPreemptTicks <= 1);
+    });
+    auto hog = coro::start([&] {
+        Time const start = Time::now();
+        while (Time::now()-start < Time::millisec(50)) {} // Many slices
+        event.notifyAll();
+        coro::sleep(Time::millisec(1)); // Hands off to the waiter
+    });
+    coro::run();
+    assert(fresh);
+    hub->preemptIs(Time());
+}
+
+static volatile sig_atomic_t urgent = 0;
+
+void testHandler() {
+// The preemption signal is left alone until preemption is turned on, and a
+// handler the program installed first still gets the signals that aren't
+// preemption ticks.
+    coro::main();
+    struct sigaction sa;
+    sigaction(CORO_PREEMPT_SIGNAL, 0, &sa);
+    assert(!(sa.sa_flags & SA_SIGINFO) && sa.sa_handler == SIG_DFL);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = [](int) { urgent = urgent+1; };
+    sigaction(CORO_PREEMPT_SIGNAL, &sa, 0);
+    auto const hub = coro::hub();
+    hub->preemptIs(Time::millisec(1));
+    raise(CORO_PREEMPT_SIGNAL);
+    assert(urgent == 1);
+    hub->preemptIs(Time());
+}
+#endif
+
+int main() {
+#ifdef __linux__
+    testHandler();
+#endif
+    testOff();
+#ifdef __linux__
+    testPreempt();
+    testMain();
+    testHandoff();
+#endif
+    return 0;
+}
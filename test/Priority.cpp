@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+using coro::Coroutine;
+
+void testOrder() {
+// Runnable coroutines run in priority order, whatever order they started in.
+    std::string order;
+    auto b = coro::start([&] { order += 'b'; });
+    auto n = coro::start([&] { order += 'n'; });
+    auto c = coro::start([&] { order += 'c'; });
+    b->priorityIs(Coroutine::BACKGROUND);
+    c->priorityIs(Coroutine::CRITICAL);
+    assert(n->priority() == Coroutine::NORMAL);
+    coro::run();
+    assert(order == "cnb");
+}
+
+void testPriorityIs() {
+// Changing the priority of a runnable coroutine moves it to the other queue.
+    std::string order;
+    auto a = coro::start([&] { order += 'a'; });
+    auto b = coro::start([&] { order += 'b'; });
+    b->priorityIs(Coroutine::CRITICAL);
+    b->priorityIs(Coroutine::CRITICAL);
+    assert(coro::hub()->runnable() == 2);
+    coro::run();
+    assert(order == "ba");
+}
+
+static std::pair<int, int> share(size_t weight) {
+// Runs one busy critical coroutine against 20 busy background ones, with the
+// background class at 'weight', until the critical one has yielded 100 times.
+// Returns the # of critical and background runs.
+    auto const hub = coro::hub();
+    size_t const old = hub->weight(Coroutine::BACKGROUND);
+    hub->weightIs(Coroutine::BACKGROUND, weight);
+    int critical = 0;
+    int background = 0;
+    bool done = false;
+    auto c = coro::start([&] {
+        for (; critical < 100; ++critical) {
+            coro::yield();
+        }
+        done = true;
+    });
+    c->priorityIs(Coroutine::CRITICAL);
+    std::vector<coro::Ptr<Coroutine>> batch;
+    for (int i = 0; i < 20; ++i) {
+        batch.push_back(coro::start([&] {
+            while (!done) {
+                background++;
+                coro::yield();
+            }
+        }));
+        batch.back()->priorityIs(Coroutine::BACKGROUND);
+    }
+    coro::run();
+    hub->weightIs(Coroutine::BACKGROUND, old);
+    return std::make_pair(critical, background);
+}
+
+void testShare() {
+// A busy critical coroutine doesn't starve background work, but background
+// work only gets its weighted share of each pass.
+    assert(coro::hub()->weight(Coroutine::BACKGROUND) == 1);
+    auto const runs = share(1);
+    assert(runs.second > 0);
+    assert(runs.second <= 2*runs.first); // FIFO would have run 20 per pass
+}
+
+void testWeight() {
+// Raising a class's weight gives it more of each pass.
+    auto const runs = share(4);
+    assert(runs.second >= 3*runs.first);
+}
+
+int main() {
+    testOrder();
+    testPriorityIs();
+    testShare();
+    testWeight();
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+void testOverflow() {
+// More operations are in flight at once than the io_uring submission queue
+// holds (with other backends, this just blocks a lot of readers), and each one
+// still completes.
+    int const count = 2*CORO_RING_SIZE;
+    std::vector<coro::Ptr<coro::Socket>> sockets;
+    std::vector<unsigned short> ports;
+    for (int i = 0; i < count; ++i) {
+        auto sd = std::make_shared<coro::Socket>(SOCK_DGRAM, IPPROTO_UDP);
+        sd->bind(coro::SocketAddr("127.0.0.1", 0));
+        struct sockaddr_in sin;
+        socklen_t len = sizeof(sin);
+        getsockname(sd->fileno(), (struct sockaddr*)&sin, &len);
+        sockets.push_back(sd);
+        ports.push_back(sin.sin_port);
+    }
+
+    int received = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> readers;
+    for (auto sd : sockets) {
+        readers.push_back(coro::start([&, sd] {
+            char buf[16];
+            ssize_t const len = sd->read(buf, sizeof(buf));
+            assert(len == 4);
+            received++;
+        }));
+    }
+    auto writer = coro::start([&] {
+        coro::yield(); // Every reader has queued its read
+        int const sd = socket(AF_INET, SOCK_DGRAM, 0);
+        for (auto port : ports) {
+            struct sockaddr_in sin;
+            memset(&sin, 0, sizeof(sin));
+            sin.sin_family = AF_INET;
+            sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            sin.sin_port = port;
+            sendto(sd, "ping", 4, 0, (struct sockaddr*)&sin, sizeof(sin));
+        }
+        ::close(sd);
+    });
+    coro::run();
+    assert(received == count);
+}
+
+int main() {
+    testOverflow();
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+#include <atomic>
+#include <set>
+
+std::atomic<int> count(0);
+std::mutex mutex;
+std::set<std::thread::id> threads;
+
+void work() {
+// CPU-bound task that yields now and then
+    volatile uint64_t sum = 0;
+    for (auto i = 0; i < 100; ++i) {
+        for (auto j = 0; j < 10000; ++j) {
+            sum += j;
+        }
+        if (i % 10 == 0) {
+            coro::yield();
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.insert(std::this_thread::get_id());
+    count++;
+}
+
+void testSteal() {
+    coro::Scheduler scheduler(4);
+    // All tasks are spawned from a single task, so they land on one worker's
+    // deque; the other workers have to steal them.
+    scheduler.start([&] {
+        for (auto i = 0; i < 200; ++i) {
+            scheduler.start(work);
+        }
+        scheduler.start([&] {
+            coro::sleep(coro::Time::millisec(10));
+            count++;
+        });
+    });
+    scheduler.join();
+    assert(count == 201);
+    assert(scheduler.steals() > 0);
+    assert(threads.size() > 1);
+}
+
+void testFollowUp() {
+    // A task that starts another one during join() and waits for it keeps
+    // join() waiting until both are done, even after the other workers have
+    // run out of work and stopped.
+    coro::Scheduler scheduler(2);
+    std::atomic<bool> done(false);
+    scheduler.start([&] {
+        coro::sleep(coro::Time::millisec(20)); // Until join() is under way
+        scheduler.start([&] { done = true; });
+        while (!done) {
+            coro::sleep(coro::Time::millisec(1));
+        }
+    });
+    scheduler.join();
+    assert(done);
+}
+
+int main() {
+    testSteal();
+    testFollowUp();
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+void testLocals() {
+// Each coroutine's locals survive while the others run on the same stack.
+    int const count = 100;
+    int sum = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 0; i < count; ++i) {
+        coros.push_back(coro::startShared([i, &sum] {
+            char buf[256];
+            memset(buf, i, sizeof(buf));
+            int const value = i*7;
+            for (int j = 0; j < 10; ++j) {
+                coro::yield();
+                for (size_t k = 0; k < sizeof(buf); ++k) {
+                    assert(buf[k] == char(i));
+                }
+                assert(value == i*7);
+            }
+            sum += value;
+        }));
+    }
+    coro::run();
+    assert(sum == 7*count*(count-1)/2);
+    for (auto coro : coros) {
+        assert(coro->status() == coro::Coroutine::EXITED);
+    }
+}
+
+int depth(int n) {
+// Recurses 'n' deep, yielding at the bottom.
+    volatile char pad[64];
+    pad[0] = char(n);
+    if (n == 0) {
+        coro::yield();
+        return 0;
+    }
+    int const ret = depth(n-1)+1;
+    assert(pad[0] == char(n));
+    return ret;
+}
+
+void testDeep() {
+// Deep frames are saved and restored intact; idle shallow ones are cheap.
+    auto done = std::make_shared<coro::Event>();
+    auto idle = coro::startShared([done] { done->wait(); });
+    int result = -1;
+    auto deep = coro::startShared([&] {
+        result = depth(1000);
+        assert(idle->status() == coro::Coroutine::WAITING);
+#if !defined(_WIN32) && !defined(CORO_IO_URING)
+        assert(idle->stackSaved() > 0 && idle->stackSaved() < 4096);
+#endif
+        done->notifyAll();
+    });
+    coro::run();
+    assert(result == 1000);
+    assert(idle->status() == coro::Coroutine::EXITED);
+    assert(deep->status() == coro::Coroutine::EXITED);
+}
+
+void testDestroy() {
+// A shared coroutine can let go of the last Ptr to another one on the same
+// stack that's suspended; the hub unwinds it from the main coroutine.
+    struct Guard {
+        bool& flag;
+        ~Guard() { flag = true; }
+    };
+    for (int shared = 0; shared < 2; ++shared) {
+        bool unwound = false;
+        int runs = 0;
+        auto func = [&] {
+            Guard guard{unwound};
+            for (;; ++runs) {
+                coro::yield();
+            }
+        };
+        coro::Ptr<coro::Coroutine> victim = shared ? coro::startShared(func) : coro::start(func);
+        auto killer = coro::startShared([&] {
+            while (runs < 3) {
+                coro::yield();
+            }
+            victim.reset();
+            assert(!unwound); // Not until the hub gets to it
+            coro::yield();
+            assert(unwound);
+        });
+        coro::run();
+        assert(unwound);
+        assert(killer->status() == coro::Coroutine::EXITED);
+    }
+}
+
+void testDestroySleeping() {
+// A sleeping coroutine whose last owner lets go unwinds when it wakes up.
+    struct Guard {
+        bool& flag;
+        ~Guard() { flag = true; }
+    };
+    bool unwound = false;
+    bool slept = false;
+    coro::Ptr<coro::Coroutine> victim = coro::startShared([&] {
+        Guard guard{unwound};
+        for (;;) {
+            coro::sleep(coro::Time::millisec(1));
+            slept = true;
+        }
+    });
+    auto killer = coro::startShared([&] {
+        while (!slept) {
+            coro::yield();
+        }
+        victim.reset();
+    });
+    coro::run();
+    assert(unwound);
+}
+
+void testDestroyWaiting() {
+// A coroutine waiting on an event whose last owner lets go unwinds when it
+// wakes up, whether it's notified or its wait times out.
+    struct Guard {
+        bool& flag;
+        ~Guard() { flag = true; }
+    };
+    for (int notify = 0; notify < 2; ++notify) {
+        auto event = std::make_shared<coro::Event>();
+        bool unwound = false;
+        bool waited = false;
+        auto const timeout = notify ? coro::Time::sec(10) : coro::Time::millisec(1);
+        coro::Ptr<coro::Coroutine> victim = coro::startShared([&] {
+            Guard guard{unwound};
+            for (;;) {
+                event->waitFor(timeout);
+                waited = true;
+            }
+        });
+        auto killer = coro::startShared([&] {
+            coro::yield(); // Let the victim start waiting
+            victim.reset();
+            if (notify) {
+                event->notifyAll();
+            }
+        });
+        coro::run();
+        assert(unwound);
+        assert(!waited); // Unwound in waitFor() as soon as it woke up
+    }
+}
+
+void testPingPong() {
+// Shared coroutines waking each other go through the run queue.
+    auto ping = std::make_shared<coro::Event>();
+    auto pong = std::make_shared<coro::Event>();
+    int pings = 0;
+    int pongs = 0;
+    auto a = coro::startShared([&] {
+        for (int i = 0; i < 1000; ++i) {
+            pings++;
+            ping->notifyAll();
+            while (pongs < pings) {
+                pong->wait();
+            }
+        }
+    });
+    auto b = coro::startShared([&] {
+        while (pongs < 1000) {
+            while (pongs == pings) {
+                ping->wait();
+            }
+            pongs++;
+            pong->notifyAll();
+        }
+    });
+    coro::run();
+    assert(pings == 1000);
+    assert(pongs == 1000);
+}
+
+void testMixed() {
+// Shared and regular coroutines interleave, including direct handoffs.
+    auto event = std::make_shared<coro::Event>();
+    int total = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 0; i < 10; ++i) {
+        auto func = [&, i] {
+            int const local = i;
+            for (int j = 0; j < 100; ++j) {
+                event->notifyAll();
+                coro::yield();
+                assert(local == i);
+            }
+            total += local;
+        };
+        coros.push_back(i%2 ? coro::startShared(func) : coro::start(func));
+    }
+    coro::run();
+    assert(total == 45);
+}
+
+void testEcho() {
+// Shared coroutines can do socket I/O, with heap-allocated sockets.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9300));
+    ls->listen(10);
+    int const clients = 10;
+    int echoed = 0;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    coros.push_back(coro::startShared([&] {
+        for (int i = 0; i < clients; ++i) {
+            coro::Ptr<coro::Socket> sd = ls->accept();
+            coros.push_back(coro::startShared([sd] {
+                char buf[64];
+                ssize_t len = 0;
+                while ((len = sd->read(buf, sizeof(buf))) > 0) {
+                    sd->writeAll(buf, len);
+                }
+            }));
+        }
+    }));
+    for (int i = 0; i < clients; ++i) {
+        coros.push_back(coro::startShared([&, i] {
+            auto sd = std::make_shared<coro::Socket>();
+            sd->connect(coro::SocketAddr("127.0.0.1", 9300));
+            char msg[32];
+            snprintf(msg, sizeof(msg), "hello %d", i);
+            sd->writeAll(msg, strlen(msg));
+            char buf[32];
+            sd->readAll(buf, strlen(msg));
+            assert(!memcmp(buf, msg, strlen(msg)));
+            echoed++;
+            sd->shutdown(SHUT_WR);
+        }));
+    }
+    coro::run();
+    assert(echoed == clients);
+}
+
+int main() {
+    testLocals();
+    testDeep();
+    testDestroy();
+    testDestroySleeping();
+    testDestroyWaiting();
+    testPingPong();
+    testMixed();
+    testEcho();
+    return 0;
+}
@@ -82,8 +82,32 @@ void testWriteDisconnect() {
     coro::run();
 }
 
+void testDupClose() {
+// A closed socket gets no more events, even if a dup of its fd stays open.
+    int dup = -1;
+    auto server = coro::start([&]{
+        char buf[1024];
+        auto sd = newServer();
+        sd->readAll(buf, msg.length()); // Blocks, so the fd gets registered
+        dup = ::dup(sd->fileno());
+    });
+
+    auto client = coro::start([]{
+        auto sd = newClient();
+        coro::sleep(coro::Time::millisec(10));
+        sd->writeAll(msg.c_str(), msg.length());
+        coro::sleep(coro::Time::millisec(10)); // Server's Socket is gone now
+        sd->writeAll(msg.c_str(), msg.length());
+        coro::sleep(coro::Time::millisec(10));
+    });
+    coro::run();
+    assert(dup >= 0);
+    ::close(dup);
+}
+
 int main() {
     testReadDisconnect();
     testWriteDisconnect();
+    testDupClose();
     return 0;
 }
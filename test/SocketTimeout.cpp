@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+using coro::Time;
+
+void testReadTimeout() {
+// A read with nothing to read times out; the socket stays usable.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9200));
+    ls->listen(10);
+    bool timedOut = false;
+    bool done = false;
+    auto server = coro::start([&] {
+        auto sd = ls->accept();
+        sd->timeoutIs(Time::millisec(20));
+        char buf[16];
+        auto const start = Time::now();
+        try {
+            sd->read(buf, sizeof(buf));
+        } catch (coro::SocketTimeoutException const&) {
+            timedOut = true;
+        }
+        assert(Time::now()-start >= Time::millisec(20));
+        assert(Time::now()-start < Time::sec(5));
+        sd->timeoutIs(Time());
+        sd->readAll(buf, 5);
+        assert(!memcmp(buf, "hello", 5));
+        done = true;
+    });
+    auto client = coro::start([&] {
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", 9200));
+        coro::sleep(Time::millisec(100));
+        sd->writeAll("hello", 5);
+    });
+    coro::run();
+    assert(timedOut);
+    assert(done);
+}
+
+void testAcceptTimeout() {
+// An accept with no peer times out.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9201));
+    ls->listen(10);
+    ls->timeoutIs(Time::millisec(10));
+    bool timedOut = false;
+    auto server = coro::start([&] {
+        try {
+            ls->accept();
+        } catch (coro::SocketTimeoutException const&) {
+            timedOut = true;
+        }
+    });
+    coro::run();
+    assert(timedOut);
+}
+
+void testDeadline() {
+// A deadline bounds a whole exchange, even when the peer keeps trickling in
+// data so that no single read waits very long.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9202));
+    ls->listen(10);
+    bool timedOut = false;
+    size_t total = 0;
+    auto server = coro::start([&] {
+        auto sd = ls->accept();
+        sd->deadlineIs(Time::now()+Time::millisec(50));
+        char buf[1024];
+        try {
+            sd->readAll(buf, sizeof(buf));
+        } catch (coro::SocketTimeoutException const&) {
+            timedOut = true;
+        }
+    });
+    auto client = coro::start([&] {
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", 9202));
+        try {
+            for (int i = 0; i < 20; ++i) {
+                sd->writeAll("x", 1);
+                total++;
+                coro::sleep(Time::millisec(10));
+            }
+        } catch (coro::SocketCloseException const&) {
+        }
+    });
+    coro::run();
+    assert(timedOut);
+    assert(total > 1);
+}
+
+void testWriteTimeout() {
+// A write to a peer that never reads times out once the buffers fill up.
+    auto ls = std::make_shared<coro::Socket>();
+    ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+    ls->bind(coro::SocketAddr("127.0.0.1", 9203));
+    ls->listen(10);
+    bool timedOut = false;
+    coro::Event finished;
+    auto server = coro::start([&] {
+        auto sd = ls->accept();
+        finished.wait([&] { return timedOut; }); // Never reads
+    });
+    auto client = coro::start([&] {
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", 9203));
+        sd->timeoutIs(Time::millisec(20));
+        std::vector<char> buf(65536);
+        try {
+            for (;;) {
+                sd->write(&buf[0], buf.size());
+            }
+        } catch (coro::SocketTimeoutException const&) {
+            timedOut = true;
+        }
+        finished.notifyAll();
+    });
+    coro::run();
+    assert(timedOut);
+}
+
+int main() {
+    testReadTimeout();
+    testAcceptTimeout();
+    testDeadline();
+    testWriteTimeout();
+    return 0;
+}
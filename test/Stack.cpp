@@ -2,6 +2,9 @@
 
 #include <coro/Common.hpp>
 #include <coro/coro.hpp>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 
 using namespace coro;
 
@@ -12,8 +15,155 @@ void recurse(int n) {
     else { recurse(n-1); }
 }
 
+#ifndef _WIN32
+int overflow(int n) {
+    volatile char data[1024];
+    data[0] = char(n);
+    if (n == INT_MAX) { return 0; }
+    return overflow(n+1)+data[0];
+}
+
+void testOverflow() {
+    // Check that a stack overflow hits the guard page and aborts, rather than
+    // corrupting memory.
+    pid_t pid = fork();
+    if (pid == 0) {
+        auto coro = coro::start([] { overflow(0); });
+        coro::run();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+#endif
+
+#ifdef __linux__
+uint64_t resident() {
+    long pages = 0;
+    long rss = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    assert(file);
+    int const n = fscanf(file, "%ld %ld", &pages, &rss);
+    assert(n == 2);
+    fclose(file);
+    return uint64_t(rss)*sysconf(_SC_PAGESIZE);
+}
+
+void testResident() {
+    // Check that idle coroutines only use the stack memory they touch.
+    Event event;
+    std::vector<Ptr<Coroutine>> coros;
+    uint64_t const before = resident();
+    for (auto i = 0; i < 1000; ++i) {
+        coros.push_back(coro::start([&] { event.wait(); }));
+    }
+    hub()->quiesce();
+    uint64_t const after = resident();
+    assert(after-before < 1000*uint64_t(CORO_STACK_SIZE)/8);
+    event.notifyAll();
+    coro::run();
+}
+#endif
+
+int touch(int n) {
+    volatile char data[4096];
+    data[0] = char(n);
+    if (n == 0) { return 0; }
+    return touch(n-1)+data[0];
+}
+
+void testTrim() {
+    // Check that the hub releases the stack pages below a long-idle
+    // coroutine's stack pointer, and that the coroutine runs fine afterwards.
+    uint64_t const trimmed = hub()->stackTrimmed();
+    hub()->stackTrimIs(Time::millisec(1));
+    auto event = std::make_shared<Event>();
+    int result = -1;
+    auto deep = coro::start([&] {
+        touch(127); // 512 KiB of stack, now unused
+        event->wait();
+        result = touch(127);
+    });
+    auto waker = coro::start([&] {
+        coro::sleep(Time::millisec(10)); // Nothing else wakes the hub
+        assert(hub()->stackTrimmed()-trimmed >= 256*1024);
+        event->notifyAll();
+    });
+    coro::run();
+    assert(result == 127*128/2);
+    hub()->stackTrimIs(Time());
+}
+
+void testOptions() {
+    // Check that coroutines get the stack they ask for at start().
+    StackPool& pool = hub()->stackPool();
+    StartOptions small;
+    small.stackSize = 32*1024;
+    small.priority = Coroutine::CRITICAL;
+    int result = -1;
+    auto coro = coro::start([&] { result = touch(2); }, small);
+    assert(coro->priority() == Coroutine::CRITICAL);
+    coro::run();
+    assert(result == 3);
+    uint64_t const bytes = pool.bytes();
+    coro.reset();
+    assert(pool.bytes() == bytes+32*1024); // Back in the 32 KiB class
+
+    small.pooled = false;
+    small.stackSize = 36*1024;
+    coro = coro::start([&] { result = touch(3); }, small);
+    coro::run();
+    assert(result == 6);
+    coro.reset();
+    assert(pool.bytes() == bytes+32*1024); // Unmapped, not pooled
+
+    for (uint32_t size : { 0, 1, 4096, 16*1024-1 }) {
+        small.stackSize = size; // Too small; gets the minimum instead
+        coro = coro::start([&] {
+            volatile char data[1024];
+            data[0] = 1;
+            result = data[0];
+        }, small);
+        coro::run();
+        assert(result == 1);
+    }
+
+    small.pooled = true;
+    small.stackSize = 16*1024*1024+3; // Too big to pool; rounded to pages
+    coro = coro::start([&] {
+        alignas(16) char data[16];
+        volatile uintptr_t addr = (uintptr_t)data; // Don't assume alignment
+        result = addr%16 == 0 ? touch(4) : -1; // Top of stack is aligned
+    }, small);
+    coro::run();
+    assert(result == 10);
+    coro.reset();
+    assert(pool.bytes() == bytes+32*1024);
+
+#ifndef _WIN32
+    pid_t pid = fork();
+    if (pid == 0) {
+        small.stackSize = 32*1024;
+        coro = coro::start([] { touch(64); }, small);
+        coro::run();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+#endif
+}
 
 int main() {
+    testTrim();
+    testOptions();
+#ifndef _WIN32
+    testOverflow();
+#endif
+#ifdef __linux__
+    testResident();
+#endif
     // Check that coroutines do not use too much stack mem
     std::vector<Ptr<Coroutine>> coros;
 
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+#include <thread>
+
+void testReuse() {
+// The stacks of destroyed coroutines are reused by new ones.
+    coro::StackPool& pool = coro::hub()->stackPool();
+    uint64_t const misses = pool.misses();
+    for (int i = 0; i < 100; ++i) {
+        auto coro = coro::start([] {});
+        coro::run();
+    }
+    assert(pool.misses()-misses <= 1);
+    assert(pool.bytes() >= CORO_STACK_SIZE);
+}
+
+void testCapacity() {
+// The pool keeps no more than its capacity, and lowering it frees stacks.
+    coro::StackPool& pool = coro::hub()->stackPool();
+    uint64_t const capacity = pool.capacity();
+    pool.capacityIs(4*CORO_STACK_SIZE);
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 0; i < 10; ++i) {
+        coros.push_back(coro::start([] {}));
+    }
+    coro::run();
+    coros.clear();
+    assert(pool.bytes() == 4*CORO_STACK_SIZE);
+    pool.capacityIs(0);
+    assert(pool.bytes() == 0);
+    uint64_t const hits = pool.hits();
+    auto coro = coro::start([] {});
+    coro::run();
+    assert(pool.hits() == hits);
+    pool.capacityIs(capacity);
+}
+
+void testOtherThread() {
+// Threads (and so hubs) have their own pools.
+    coro::StackPool* pool = coro::StackPool::local();
+    assert(pool == &coro::hub()->stackPool());
+    std::thread thread([&] {
+        assert(coro::StackPool::local() == 0 || coro::StackPool::local() != pool);
+        auto coro = coro::start([] {});
+        coro::run();
+        assert(coro::StackPool::local() == &coro::hub()->stackPool());
+    });
+    thread.join();
+}
+
+int main() {
+    testReuse();
+    testCapacity();
+    testOtherThread();
+    return 0;
+}
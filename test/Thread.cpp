@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+#include <thread>
+#include <atomic>
+
+std::atomic<int> done(0);
+
+void worker(short port) {
+// Runs an independent hub on this thread: a server/client pair talking over a
+// socket, plus a coroutine that sleeps and yields.
+    auto const hub = coro::hub();
+    auto const main = coro::main();
+    assert(coro::current() == main);
+
+    auto server = coro::start([=]{
+        auto ls = std::make_shared<coro::Socket>();
+        ls->setsockopt(SOL_SOCKET, SO_REUSEADDR, 1);
+        ls->bind(coro::SocketAddr("127.0.0.1", port));
+        ls->listen(10);
+        auto sd = ls->accept();
+        char buf[1024];
+        size_t total = 0;
+        while (ssize_t len = sd->read(buf, sizeof(buf))) {
+            total += len;
+        }
+        assert(total == 1000*5);
+    });
+    auto client = coro::start([=]{
+        auto sd = std::make_shared<coro::Socket>();
+        sd->connect(coro::SocketAddr("127.0.0.1", port));
+        for (auto i = 0; i < 1000; ++i) {
+            sd->writeAll("hello", 5);
+            if (i % 100 == 0) {
+                coro::yield();
+            }
+        }
+    });
+    auto sleeper = coro::start([=]{
+        for (auto i = 0; i < 5; ++i) {
+            coro::sleep(coro::Time::millisec(10));
+            assert(coro::hub() == hub);
+            assert(coro::main() == main);
+        }
+    });
+
+    coro::run();
+    assert(server->status() == coro::Coroutine::EXITED);
+    assert(client->status() == coro::Coroutine::EXITED);
+    assert(sleeper->status() == coro::Coroutine::EXITED);
+    done++;
+}
+
+int main() {
+    std::vector<std::thread> threads;
+    for (short i = 0; i < 4; ++i) {
+        threads.push_back(std::thread(worker, short(9100+i)));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(done == 4);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+using coro::Time;
+
+struct Record {
+    Record() : timer([this] { fire(); }), fired(0) {}
+    void fire() {
+        assert(now >= timer.time()); // Never early
+        assert(now-timer.time() <= slack); // Never late
+        fired++;
+    }
+    coro::Timer timer;
+    int fired;
+    static Time now;
+    static Time slack;
+};
+
+Time Record::now;
+Time Record::slack;
+
+void testRandom(Time const& start) {
+// Schedules timers across all levels of the wheel, cancels some, and checks
+// that the rest fire exactly once, on time.
+    coro::TimerWheel wheel;
+    Record::now = start;
+    Record::slack = Time();
+    wheel.advance(start);
+    std::vector<Record> record(10000);
+    srand(1);
+    for (size_t i = 0; i < record.size(); ++i) {
+        int64_t const range = int64_t(1) << (rand()%36);
+        int64_t const delta = (int64_t(rand()) << 20 | rand()) % range;
+        wheel.timerIs(&record[i].timer, start+Time::microsec(delta));
+    }
+    assert(wheel.size() == record.size());
+    for (size_t i = 0; i < record.size(); i += 3) {
+        wheel.timerDel(&record[i].timer);
+        assert(!record[i].timer.pending());
+    }
+    // Jump straight to the next possible expiry each time, so that every
+    // timer can be checked for lateness with zero slack.
+    while (!wheel.empty()) {
+        Time const next = wheel.next();
+        assert(next >= Record::now);
+        Record::now = next;
+        wheel.advance(next);
+    }
+    for (size_t i = 0; i < record.size(); ++i) {
+        assert(record[i].fired == ((i % 3) ? 1 : 0));
+    }
+}
+
+void testCoarse() {
+// Advancing in big steps fires everything that's due, in one batch.
+    coro::TimerWheel wheel;
+    Time const start = Time::sec(1400000000);
+    wheel.advance(start);
+    std::vector<Record> record(1000);
+    for (size_t i = 0; i < record.size(); ++i) {
+        wheel.timerIs(&record[i].timer, start+Time::millisec(int64_t(i)));
+    }
+    Record::slack = Time::millisec(100);
+    for (Record::now = start; !wheel.empty(); Record::now += Time::millisec(100)) {
+        wheel.advance(Record::now);
+    }
+    for (auto& r : record) {
+        assert(r.fired == 1);
+    }
+}
+
+void testReschedule() {
+// Rescheduling moves a timer; destroying one cancels it.
+    coro::TimerWheel wheel;
+    Time const start = Time::sec(1400000000);
+    wheel.advance(start);
+    Record::slack = Time();
+    Record a;
+    {
+        Record b;
+        wheel.timerIs(&b.timer, start+Time::millisec(5));
+    }
+    assert(wheel.empty());
+    wheel.timerIs(&a.timer, start+Time::sec(10));
+    wheel.timerIs(&a.timer, start+Time::millisec(1));
+    assert(wheel.size() == 1);
+    while (!wheel.empty()) {
+        Record::now = wheel.next(); // Lower bound; may take a few cascades
+        assert(Record::now <= start+Time::millisec(1));
+        wheel.advance(Record::now);
+    }
+    assert(a.fired == 1);
+}
+
+void testSleep() {
+// Many coroutines sleeping on the hub's wheel wake up in time order.
+    std::vector<int> order;
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 9; i >= 0; --i) {
+        coros.push_back(coro::start([&order, i] {
+            coro::sleep(Time::millisec(5*i));
+            order.push_back(i);
+        }));
+    }
+    coro::run();
+    for (int i = 0; i < 10; ++i) {
+        assert(order[i] == i);
+    }
+}
+
+void testClock() {
+// The clock is monotonic, and the hub's cached time moves forward across
+// waits.
+    Time last = Time::now();
+    for (int i = 0; i < 100000; ++i) {
+        Time const now = Time::now();
+        assert(now >= last);
+        last = now;
+    }
+
+    auto const hub = coro::hub();
+    auto waiter = coro::start([&] {
+        Time const before = hub->now();
+        coro::sleep(Time::millisec(10));
+        assert(hub->now()-before >= Time::millisec(10));
+        assert(Time::now()-hub->now() < Time::millisec(100));
+    });
+    coro::run();
+}
+
+void testShortSleep() {
+// Sleeps shorter than a millisecond aren't rounded up to the poller's tick,
+// and are measured from the actual time even if the caller has been running
+// for a while since the hub's cached time was last refreshed.
+    assert(Time::nanosec(1500).microsec() == 1);
+    assert(Time::sec(1e-9).nanosec() == 1);
+    assert(Time::microsec(50).nanosec() == 50000);
+
+    auto waiter = coro::start([] {
+        Time slept;
+        for (int i = 0; i < 20; ++i) {
+            Time const busy = Time::now();
+            while (Time::now()-busy < Time::microsec(100)) {} // Stale now()
+            Time const before = Time::now();
+            coro::sleep(Time::microsec(50));
+            slept += Time::now()-before;
+            assert(Time::now()-before >= Time::microsec(50));
+        }
+        assert(slept < Time::millisec(10));
+    });
+    coro::run();
+}
+
+int main() {
+    testClock();
+    testShortSleep();
+    testRandom(Time::sec(1400000000));
+    testRandom(Time::microsec((int64_t(1) << 48)-1)); // End of the wheel's range
+    testCoarse();
+    testReschedule();
+    testSleep();
+    return 0;
+}
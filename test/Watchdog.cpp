@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+#include <thread>
+
+using coro::Time;
+
+std::mutex mutex;
+std::vector<coro::Stall> stalls;
+
+void record(coro::Stall const& stall) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stalls.push_back(stall);
+}
+
+void testIdle() {
+// A hub waiting in poll() isn't stalled.
+    auto const hub = coro::hub();
+    hub->watchdogIs(Time::millisec(20), record);
+    auto sleeper = coro::start([] { coro::sleep(Time::millisec(200)); });
+    coro::run();
+    hub->watchdogIs(Time());
+    assert(stalls.empty());
+}
+
+void testStall() {
+// A coroutine stuck in a blocking call is reported once, with a backtrace.
+    auto const hub = coro::hub();
+    hub->watchdogIs(Time::millisec(20), record);
+    auto blocker = coro::start([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    });
+    auto other = coro::start([] { coro::sleep(Time::millisec(10)); });
+    coro::run();
+    hub->watchdogIs(Time());
+    assert(stalls.size() == 1);
+    assert(stalls[0].hub == hub.get());
+    assert(stalls[0].coroutine == blocker.get());
+    assert(stalls[0].duration >= Time::millisec(20));
+#ifdef __linux__
+    assert(!stalls[0].backtrace.empty());
+#endif
+    coro::stallPrint(stalls[0]);
+}
+
+void testOutside() {
+// The thread isn't watched once it has returned from run().
+    auto const hub = coro::hub();
+    hub->watchdogIs(Time::millisec(20), record);
+    auto sleeper = coro::start([] { coro::sleep(Time::millisec(10)); });
+    coro::run();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    hub->watchdogIs(Time());
+    assert(stalls.empty());
+}
+
+#ifdef __linux__
+static volatile sig_atomic_t urgent = 0;
+
+void testHandler() {
+// A handler the program installed before the first watchdog still gets the
+// signals that aren't backtrace requests.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = [](int) { urgent = urgent+1; };
+    sigaction(CORO_WATCHDOG_SIGNAL, &sa, 0);
+    auto const hub = coro::hub();
+    hub->watchdogIs(Time::millisec(20), record);
+    raise(CORO_WATCHDOG_SIGNAL);
+    assert(urgent == 1);
+    hub->watchdogIs(Time());
+}
+
+void testLateTrace() {
+// A backtrace request that the hub's thread only sees after the watchdog gave
+// up on it (and was destroyed) is ignored, and later requests still work.
+    auto const hub = coro::hub();
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, CORO_WATCHDOG_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &set, 0);
+    hub->watchdogIs(Time::millisec(20), record);
+    auto blocker = coro::start([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    });
+    coro::run();
+    hub->watchdogIs(Time());
+    assert(stalls.size() == 1);
+    assert(stalls[0].backtrace.empty());
+    pthread_sigmask(SIG_UNBLOCK, &set, 0); // Stale request arrives now
+    stalls.clear();
+
+    hub->watchdogIs(Time::millisec(20), record);
+    blocker = coro::start([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    });
+    coro::run();
+    hub->watchdogIs(Time());
+    assert(stalls.size() == 1);
+    assert(!stalls[0].backtrace.empty());
+    stalls.clear();
+}
+#endif
+
+int main() {
+#ifdef __linux__
+    testHandler(); // First, before any watchdog installs its handler
+#endif
+    testIdle();
+    testOutside();
+#ifdef __linux__
+    testLateTrace();
+#endif
+    testStall();
+    return 0;
+}
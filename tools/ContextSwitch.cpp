@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+// Measures scheduler throughput: N coroutines yield to the hub in a loop, so
+// every switch goes through the hub's run queue.  Usage:
+//
+//   coro-ContextSwitch [coroutines] [yields-per-coroutine]
+
+int main(int argc, char** argv) {
+    int const coroutines = (argc > 1) ? atoi(argv[1]) : 1000;
+    int const yields = (argc > 2) ? atoi(argv[2]) : 10000;
+
+    std::vector<coro::Ptr<coro::Coroutine>> coros;
+    for (int i = 0; i < coroutines; ++i) {
+        coros.push_back(coro::start([=] {
+            for (int j = 0; j < yields; ++j) {
+                coro::yield();
+            }
+        }));
+    }
+
+    coro::Time const start = coro::Time::now();
+    coro::run();
+    coro::Time const elapsed = coro::Time::now()-start;
+
+    // Each yield is two switches: coroutine to hub, and hub to coroutine.
+    double const switches = 2.*coroutines*yields;
+    printf("coroutines: %d\n", coroutines);
+    printf("yields: %d\n", yields);
+    printf("elapsed: %.3f s\n", elapsed.sec());
+    printf("switches/s: %.0f\n", switches/elapsed.sec());
+    return 0;
+}
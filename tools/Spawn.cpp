@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2014 Matt Fichman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, APEXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <coro/Common.hpp>
+#include <coro/coro.hpp>
+
+// Measures coroutine spawn/exit throughput: coroutines are started in batches
+// and run to completion, as with a coroutine per request.  Runs once with the
+// hub's stack pool turned off and once with it big enough for a batch.  Usage:
+//
+//   coro-Spawn [coroutines] [batch] [stack bytes]
+
+coro::StartOptions options;
+
+double spawn(int coroutines, int batch) {
+    int ran = 0;
+    coro::Time const start = coro::Time::now();
+    for (int i = 0; i < coroutines; i += batch) {
+        std::vector<coro::Ptr<coro::Coroutine>> coros;
+        for (int j = 0; j < batch; ++j) {
+            coros.push_back(coro::start([&] { ran++; }, options));
+        }
+        coro::run();
+    }
+    coro::Time const elapsed = coro::Time::now()-start;
+    assert(ran >= coroutines);
+    return ran/elapsed.sec();
+}
+
+int main(int argc, char** argv) {
+    int const coroutines = (argc > 1) ? atoi(argv[1]) : 100000;
+    int const batch = (argc > 2) ? atoi(argv[2]) : 100;
+    options.stackSize = (argc > 3) ? atoi(argv[3]) : CORO_STACK_SIZE;
+    coro::StackPool& pool = coro::hub()->stackPool();
+
+    printf("coroutines: %d\n", coroutines);
+    printf("batch: %d\n", batch);
+    printf("stack: %u bytes\n", options.stackSize);
+    pool.capacityIs(0);
+    printf("spawns/s (no pool): %.0f\n", spawn(coroutines, batch));
+    pool.capacityIs(uint64_t(batch)*options.stackSize);
+    uint64_t const hits = pool.hits();
+    uint64_t const misses = pool.misses();
+    printf("spawns/s (pool): %.0f\n", spawn(coroutines, batch));
+    printf("pool hits: %llu\n", (unsigned long long)(pool.hits()-hits));
+    printf("pool misses: %llu\n", (unsigned long long)(pool.misses()-misses));
+    return 0;
+}